@@ -0,0 +1,84 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <sys/types.h>
+
+/** A rectangle in pixels */
+struct Rect
+{
+    ssize_t x;
+    ssize_t y;
+    ssize_t width;
+    ssize_t height;
+    
+    bool overlaps(const Rect & other) const
+    {
+        return x < other.x + other.width && other.x < x + width &&
+               y < other.y + other.height && other.y < y + height;
+    }
+};
+
+/** An 8-bit grayscale image held in memory, which is how sprites are
+ * decoded and maps are drawn. Only *_plus_mask sprites have an alpha
+ * plane; map sprites are opaque, so drawing one is a clipped copy of
+ * its rows, while the others are drawn only where they are opaque. */
+struct Bitmap
+{
+    size_t width;
+    size_t height;
+    std::vector<uint8_t> pixels;
+    std::vector<uint8_t> alpha;     // 0x00 or 0xFF per pixel, empty if opaque
+    
+    Bitmap(size_t width=0, size_t height=0, uint8_t fill=0xFF) :
+        width(width), height(height), pixels(width * height, fill)
+    {
+    }
+    
+    /** Copies the pixels of a sprite with its top-left corner at (x, y),
+     * transparent ones included */
+    void copy(const Bitmap & sprite, ssize_t x, ssize_t y)
+    {
+        ssize_t left = std::max<ssize_t>(0, -x);
+        ssize_t right = std::min<ssize_t>(sprite.width, (ssize_t)width - x);
+        ssize_t top = std::max<ssize_t>(0, -y);
+        ssize_t bottom = std::min<ssize_t>(sprite.height, (ssize_t)height - y);
+        
+        for (ssize_t row = top; row < bottom && left < right; row++)
+        {
+            memcpy(&pixels[(y + row) * width + x + left],
+                &sprite.pixels[row * sprite.width + left], right - left);
+        }
+    }
+    
+    /** Draws a sprite with its top-left corner at (x, y). Opaque sprites
+     * are copied a row at a time; others only where their alpha is set,
+     * like OverCompositeOp with the 1-bit masks of *_plus_mask sprites. */
+    void blit(const Bitmap & sprite, ssize_t x, ssize_t y)
+    {
+        if (sprite.alpha.empty())
+        {
+            copy(sprite, x, y);
+            return;
+        }
+        
+        ssize_t left = std::max<ssize_t>(0, -x);
+        ssize_t right = std::min<ssize_t>(sprite.width, (ssize_t)width - x);
+        ssize_t top = std::max<ssize_t>(0, -y);
+        ssize_t bottom = std::min<ssize_t>(sprite.height, (ssize_t)height - y);
+        
+        for (ssize_t row = top; row < bottom; row++)
+        {
+            for (ssize_t col = left; col < right; col++)
+            {
+                size_t i = row * sprite.width + col;
+                if (sprite.alpha[i] >= 0x80) pixels[(y + row) * width + x + col] = sprite.pixels[i];
+            }
+        }
+    }
+};
+
+#endif
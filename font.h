@@ -0,0 +1,86 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include <string>
+#include <cctype>
+#include "bitmap.h"
+
+/* A 3x5 pixel font for labels: digits then lowercase letters. Each glyph
+ * is 5 rows of 3 bits, top row in the highest bits. */
+static const uint16_t font_glyphs[] = {
+    0x7B6F,     // 0
+    0x2C97,     // 1
+    0x73E7,     // 2
+    0x73CF,     // 3
+    0x5BC9,     // 4
+    0x79CF,     // 5
+    0x79EF,     // 6
+    0x7249,     // 7
+    0x7BEF,     // 8
+    0x7BCF,     // 9
+    0x2BED,     // a
+    0x6BAE,     // b
+    0x3923,     // c
+    0x6B6E,     // d
+    0x79A7,     // e
+    0x79A4,     // f
+    0x396B,     // g
+    0x5BED,     // h
+    0x7497,     // i
+    0x126A,     // j
+    0x5BAD,     // k
+    0x4927,     // l
+    0x5FED,     // m
+    0x6B6D,     // n
+    0x2B6A,     // o
+    0x6BA4,     // p
+    0x2B73,     // q
+    0x6BAD,     // r
+    0x388E,     // s
+    0x7492,     // t
+    0x5B6F,     // u
+    0x5B6A,     // v
+    0x5BFD,     // w
+    0x5AAD,     // x
+    0x5A92,     // y
+    0x72A7,     // z
+};
+
+static const size_t FONT_WIDTH = 3;
+static const size_t FONT_HEIGHT = 5;
+
+/** Draws text in black with its top-left corner at (x, y), with every
+ * font pixel scale pixels wide. Letters are drawn in lowercase; anything
+ * but letters and digits is left blank. Text is cut short before the
+ * first glyph that would reach past max_width, so callers drawing into
+ * their own part of a shared bitmap never touch a neighbour's. Returns
+ * the width drawn. */
+inline size_t draw_text(Bitmap & bitmap, size_t x, size_t y, const std::string & text, size_t scale=1,
+                        size_t max_width=SIZE_MAX)
+{
+    size_t start = x;
+    for (char c : text)
+    {
+        if (x - start + FONT_WIDTH * scale > max_width) break;
+        
+        c = tolower((unsigned char)c);
+        uint16_t glyph = 0;
+        if (c >= '0' && c <= '9') glyph = font_glyphs[c - '0'];
+        if (c >= 'a' && c <= 'z') glyph = font_glyphs[10 + c - 'a'];
+        
+        for (size_t row = 0; row < FONT_HEIGHT * scale; row++)
+        {
+            for (size_t col = 0; col < FONT_WIDTH * scale; col++)
+            {
+                size_t bit = (FONT_HEIGHT - 1 - row / scale) * FONT_WIDTH + (FONT_WIDTH - 1 - col / scale);
+                if (!((glyph >> bit) & 1) || x + col >= bitmap.width || y + row >= bitmap.height) continue;
+                bitmap.pixels[(y + row) * bitmap.width + x + col] = 0x00;
+            }
+        }
+        x += (FONT_WIDTH + 1) * scale;
+    }
+    
+    return x - start;
+}
+
+#endif
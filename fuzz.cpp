@@ -0,0 +1,25 @@
+/* libFuzzer harness for the level parser, built by `make fuzz` with clang.
+ * 
+ * Levels come from packs and --validate as untrusted bytes, so anything
+ * validate_level accepts must load and turn into a display list without
+ * reading outside the data. The parser lives in main.cpp, which is built
+ * into the harness with its main() renamed. */
+#define main mbmapper_main
+#include "main.cpp"
+#undef main
+
+extern "C" int LLVMFuzzerInitialize(int *, char ***)
+{
+    load_sprite_bitmaps();
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+    if (validate_level(data, size)) return 0;
+    
+    load_map_cells(data);
+    load_objects(data, size);
+    render_bitmap(make_display_list(data, size));
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include "gifwrite.h"
+
+
+/* Colour indices. The palette is only as large as the frames need. */
+static const uint8_t GIF_BLACK = 0;
+static const uint8_t GIF_WHITE = 1;
+static const uint8_t GIF_CLEAR = 2;
+
+/* Codes start one bit wider than the indices, which GIF sets at 2 bits
+ * or more, and never grow past 12 bits */
+static const unsigned GIF_MIN_CODE_SIZE = 2;
+static const unsigned GIF_MAX_CODES = 4096;
+
+/** Appends a 16-bit little-endian value */
+static void put16(std::vector<uint8_t> & out, uint16_t value)
+{
+    out.push_back(value);
+    out.push_back(value >> 8);
+}
+
+/** Packs LZW codes least significant bit first into data sub-blocks */
+class GifBits
+{
+    public:
+        GifBits(std::vector<uint8_t> & out) : out(out), bits(0), count(0)
+        {
+        }
+        
+        void put(unsigned code, unsigned size)
+        {
+            bits |= code << count;
+            count += size;
+            while (count >= 8)
+            {
+                byte(bits);
+                bits >>= 8;
+                count -= 8;
+            }
+        }
+        
+        /** Writes out the last partial byte and the block terminator */
+        void finish()
+        {
+            if (count > 0) byte(bits);
+            if (!block.empty()) flush();
+            out.push_back(0);
+        }
+        
+    protected:
+        std::vector<uint8_t> & out;
+        std::vector<uint8_t> block;
+        uint32_t bits;
+        unsigned count;
+        
+        void byte(uint8_t value)
+        {
+            block.push_back(value);
+            if (block.size() == 255) flush();
+        }
+        
+        void flush()
+        {
+            out.push_back(block.size());
+            out.insert(out.end(), block.begin(), block.end());
+            block.clear();
+        }
+};
+
+/** LZW-compresses colour indices into image data. The string table is a
+ * trie with one child slot per colour, so extending a string is a single
+ * lookup; it starts again with a clear code once all 4096 codes are used. */
+static void compress_indices(std::vector<uint8_t> & out, const std::vector<uint8_t> & indices)
+{
+    const unsigned clear = 1 << GIF_MIN_CODE_SIZE;
+    const unsigned end = clear + 1;
+    std::vector<uint16_t> next(GIF_MAX_CODES * clear, 0);
+    
+    out.push_back(GIF_MIN_CODE_SIZE);
+    GifBits bits(out);
+    unsigned size = GIF_MIN_CODE_SIZE + 1;
+    unsigned last = end;                // highest code in use
+    bits.put(clear, size);
+    
+    unsigned prefix = indices[0];
+    for (size_t i = 1; i < indices.size(); i++)
+    {
+        uint8_t index = indices[i];
+        uint16_t & child = next[prefix * clear + index];
+        if (child)
+        {
+            prefix = child;
+            continue;
+        }
+        
+        bits.put(prefix, size);
+        child = ++last;
+        if (last >= (1u << size)) size++;
+        if (last == GIF_MAX_CODES - 1)
+        {
+            bits.put(clear, size);
+            std::fill(next.begin(), next.end(), 0);
+            size = GIF_MIN_CODE_SIZE + 1;
+            last = end;
+        }
+        prefix = index;
+    }
+    
+    bits.put(prefix, size);
+    bits.put(end, size);
+    bits.finish();
+}
+
+std::vector<uint8_t> encode_gif(const std::vector<Bitmap> & frames, size_t delay)
+{
+    bool transparent = false;
+    for (const Bitmap & frame : frames)
+    {
+        transparent |= !frame.alpha.empty();
+    }
+    
+    const Bitmap & first = frames.at(0);
+    std::vector<uint8_t> out = {'G', 'I', 'F', '8', '9', 'a'};
+    put16(out, first.width);
+    put16(out, first.height);
+    out.push_back(0x80 | 0x10 | (transparent ? 1 : 0));    // global palette of 2 or 4 colours
+    out.push_back(GIF_WHITE);                               // background
+    out.push_back(0);                                       // square pixels
+    
+    const uint8_t palette[] = {0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    out.insert(out.end(), palette, palette + (transparent ? 12 : 6));
+    
+    /* Loop forever */
+    if (frames.size() > 1)
+    {
+        const uint8_t loop[] = {0x21, 0xFF, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 3, 1, 0, 0, 0};
+        out.insert(out.end(), loop, loop + sizeof(loop));
+    }
+    
+    std::vector<uint8_t> indices;
+    for (const Bitmap & frame : frames)
+    {
+        /* Graphic control: clear the frame before the next one is drawn,
+         * which also lets transparent frames show the background */
+        out.push_back(0x21);
+        out.push_back(0xF9);
+        out.push_back(4);
+        out.push_back((2 << 2) | (transparent ? 1 : 0));
+        put16(out, delay);
+        out.push_back(transparent ? GIF_CLEAR : 0);
+        out.push_back(0);
+        
+        out.push_back(0x2C);
+        put16(out, 0);
+        put16(out, 0);
+        put16(out, frame.width);
+        put16(out, frame.height);
+        out.push_back(0);                                   // no local palette
+        
+        indices.resize(frame.pixels.size());
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            if (!frame.alpha.empty() && !frame.alpha[i]) indices[i] = GIF_CLEAR;
+            else indices[i] = (frame.pixels[i] >= 0x80) ? GIF_WHITE : GIF_BLACK;
+        }
+        compress_indices(out, indices);
+    }
+    
+    out.push_back(0x3B);
+    return out;
+}
@@ -0,0 +1,14 @@
+#ifndef GIFWRITE_H
+#define GIFWRITE_H
+
+#include <vector>
+#include <cstdint>
+#include "bitmap.h"
+
+/** Encodes bitmaps of the same size as the frames of a looping GIF, with
+ * the given delay between them in 1/100ths of a second. Pixels become
+ * black or white; frames with an alpha plane are transparent where it is
+ * clear, and each frame replaces the one before. */
+std::vector<uint8_t> encode_gif(const std::vector<Bitmap> & frames, size_t delay);
+
+#endif
@@ -1,14 +1,47 @@
+#ifndef NO_MAGICK
 #include <Magick++.h>
+#endif
 #include <vector>
 #include <cstdint>
 #include <iostream>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include <map>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <fnmatch.h>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
+#ifndef NO_MAGICK
 using namespace Magick;
+#endif
 
 // Dummy definitions so I don't need to strip them off or convert them
 #define PROGMEM
 typedef uint8_t byte;
 
+#include "writer.h"
+#include "bitmap.h"
+#include "tty.h"
+#include "pngwrite.h"
+#include "gifwrite.h"
+#include "qoiwrite.h"
+#include "pnmwrite.h"
+#include "pack.h"
+#include "similar.h"
+#include "font.h"
 #include "bitmaps.h"
 #include "globals.h"
 
@@ -22,12 +55,9 @@ typedef uint8_t byte;
  *   https://community.arduboy.com/t/team-arg-disappeared-how-to-get-their-games/8891
  */
 
-/** Loads a single frame from an Arduboy multi-frame sprite. */
-Image load_arduboy_frame(const uint8_t * imgreg, size_t width, size_t height, bool masked=false)
+/** Unpacks a single frame of an Arduboy sprite into 8-bit gray pixels */
+void unpack_arduboy_frame(const uint8_t * imgreg, size_t width, size_t height, bool masked, uint8_t * workmem)
 {
-    size_t imglength = width * height;
-    uint8_t * workmem = new uint8_t[imglength];
-
     for (size_t x = 0; x < width; x++)
     {
         for (size_t ybyte = 0; ybyte < height / 8; ybyte++)
@@ -50,35 +80,497 @@ Image load_arduboy_frame(const uint8_t * imgreg, size_t width, size_t height, bo
             }
         }
     }
+}
+
+/** Decodes every frame of an Arduboy sprite without a width, height header */
+std::vector<Bitmap> decode_arduboy_frames(const uint8_t * imgreg, size_t data_length,
+        size_t width, size_t height, bool masked=false)
+{
+    const size_t frame_size = (width * height) / 8;
+    const size_t num_frames = data_length / frame_size;
+    
+    std::vector<Bitmap> result;
+    
+    for (size_t i = 0; i < num_frames; i++)
+    {
+        result.push_back(Bitmap(width, height));
+        unpack_arduboy_frame(imgreg + frame_size * i, width, height, masked, result.back().pixels.data());
+    }
 
-    Blob dblob(workmem, imglength);
-    delete[] workmem;
+    return result;
+}
 
-    Image img(dblob, Geometry(width, height), 8, "GRAY");
-    return img;
+/** Decodes a full multi-frame Arduboy sprite */
+std::vector<Bitmap> decode_arduboy(const uint8_t * data, size_t length, bool masked=false)
+{
+    return decode_arduboy_frames(data + 2, length - 2, data[0], data[1], masked);
 }
 
-/** Loads a full multi-frame Arduboy sprite as a list of images */
-std::vector<Image> load_arduboy(const uint8_t * data, size_t length, bool masked=false)
+/** Decodes a single frame from an Arduboy sprite stored in the interleaved
+ * *_plus_mask layout, where every image byte is followed by its mask byte.
+ * The image and alpha planes are filled in the same pass. */
+Bitmap decode_arduboy_plus_mask_frame(const uint8_t * imgreg, size_t width, size_t height)
+{
+    Bitmap bitmap(width, height);
+    bitmap.alpha.resize(width * height);
+
+    for (size_t ybyte = 0; ybyte < height / 8; ybyte++)
+    {
+        for (size_t x = 0; x < width; x++)
+        {
+            uint8_t inbyte = imgreg[(width * ybyte + x) * 2];
+            uint8_t maskbyte = imgreg[(width * ybyte + x) * 2 + 1];
+            for (size_t ybit = 0; ybit < 8; ybit++)
+            {
+                size_t outidx = width * (ybyte * 8 + ybit) + x;
+                bitmap.pixels[outidx] = (inbyte & 1) ? 0xFF : 0x00;
+                bitmap.alpha[outidx] = (maskbyte & 1) ? 0xFF : 0x00;
+                inbyte = inbyte >> 1;
+                maskbyte = maskbyte >> 1;
+            }
+        }
+    }
+
+    return bitmap;
+}
+
+/** Decodes a full multi-frame Arduboy *_plus_mask sprite, with
+ * transparency */
+std::vector<Bitmap> decode_arduboy_plus_mask(const uint8_t * data, size_t length)
 {
     const size_t width = data[0];
     const size_t height = data[1];
     const uint8_t * imgreg = data + 2;
-    const size_t frame_size = (width * height) / 8;
-    const size_t data_length = length - 2;
-    const size_t num_frames = data_length / frame_size;
+    const size_t frame_size = (width * height) / 4;
+    const size_t num_frames = (length - 2) / frame_size;
     
-    std::vector<Image> result;
+    std::vector<Bitmap> result;
     
     for (size_t i = 0; i < num_frames; i++)
     {
-        const uint8_t * framereg = imgreg + frame_size * i;
-        result.push_back(load_arduboy_frame(framereg, width, height, masked));
+        result.push_back(decode_arduboy_plus_mask_frame(imgreg + frame_size * i, width, height));
+    }
+
+    return result;
+}
+
+/** Places the frames of a sprite side by side */
+Bitmap append_bitmaps(const std::vector<Bitmap> & frames)
+{
+    size_t width = 0;
+    size_t height = 0;
+    bool alpha = false;
+    for (const Bitmap & frame : frames)
+    {
+        width += frame.width;
+        height = std::max(height, frame.height);
+        alpha |= !frame.alpha.empty();
+    }
+    
+    Bitmap sheet(width, height);
+    if (alpha) sheet.alpha.resize(width * height, 0x00);
+    
+    size_t x = 0;
+    for (const Bitmap & frame : frames)
+    {
+        sheet.copy(frame, x, 0);
+        for (size_t y = 0; y < frame.height && alpha; y++)
+        {
+            for (size_t col = 0; col < frame.width; col++)
+            {
+                size_t i = y * frame.width + col;
+                sheet.alpha[y * width + x + col] = frame.alpha.empty() ? 0xFF : frame.alpha[i];
+            }
+        }
+        x += frame.width;
+    }
+    
+    return sheet;
+}
+
+#ifndef NO_MAGICK
+/** Converts a decoded bitmap to an image, keeping any transparency */
+Image bitmap_image(const Bitmap & bitmap)
+{
+    if (bitmap.alpha.empty())
+    {
+        Blob dblob(bitmap.pixels.data(), bitmap.pixels.size());
+        return Image(dblob, Geometry(bitmap.width, bitmap.height), 8, "GRAY");
+    }
+    
+    std::vector<uint8_t> workmem(bitmap.pixels.size() * 4);
+    for (size_t i = 0; i < bitmap.pixels.size(); i++)
+    {
+        workmem[i * 4] = workmem[i * 4 + 1] = workmem[i * 4 + 2] = bitmap.pixels[i];
+        workmem[i * 4 + 3] = bitmap.alpha[i];
+    }
+    
+    Blob dblob(workmem.data(), workmem.size());
+    return Image(dblob, Geometry(bitmap.width, bitmap.height), 8, "RGBA");
+}
+
+std::vector<Image> bitmap_images(const std::vector<Bitmap> & bitmaps)
+{
+    std::vector<Image> result;
+    for (const Bitmap & bitmap : bitmaps)
+    {
+        result.push_back(bitmap_image(bitmap));
     }
+    
+    return result;
+}
+
+/** Loads a full multi-frame Arduboy sprite as a list of images */
+std::vector<Image> load_arduboy(const uint8_t * data, size_t length, bool masked=false)
+{
+    return bitmap_images(decode_arduboy(data, length, masked));
+}
+
+#endif
+
+/* Layouts of image arrays in bitmaps.h, as detected by registry.awk */
+enum AssetLayout
+{
+    ASSET_PLAIN,        // width, height header then frames
+    ASSET_RAW,          // frames only, size taken from the source layout
+    ASSET_PLUS_MASK     // header then interleaved image and mask bytes
+};
+
+struct AssetInfo
+{
+    const char * name;
+    const uint8_t * data;
+    size_t length;
+    size_t width;
+    size_t height;
+    AssetLayout layout;
+};
+
+/* Every image array in bitmaps.h */
+static const AssetInfo assets[] = {
+#define ASSET(name, width, height, layout) {#name, name, sizeof(name), width, height, layout},
+#define LEVEL(name, sequence, flags)
+#include "registry.inc"
+#undef ASSET
+#undef LEVEL
+};
+
+/** Decodes all frames of a registered asset */
+std::vector<Bitmap> decode_asset(const AssetInfo & asset)
+{
+    switch (asset.layout)
+    {
+    case ASSET_PLUS_MASK:
+        return decode_arduboy_plus_mask(asset.data, asset.length);
+    case ASSET_RAW:
+        return decode_arduboy_frames(asset.data, asset.length, asset.width, asset.height);
+    default:
+        return decode_arduboy(asset.data, asset.length);
+    }
+}
+
+/* Number of worker threads for parallel stages */
+static size_t jobs = std::max(1U, std::thread::hardware_concurrency());
+
+/** Runs func(i) for every i in [0, count) across the worker threads.
+ * The first exception thrown by any call is rethrown once all threads
+ * have finished. */
+template <typename Func>
+void parallel_for(size_t count, Func func)
+{
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex errorlock;
+    
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < count; i = next++)
+        {
+            try
+            {
+                func(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorlock);
+                if (!error) error = std::current_exception();
+            }
+        }
+    };
+    
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < std::min(jobs, count); t++)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread & thread : threads)
+    {
+        thread.join();
+    }
+    
+    if (error) std::rethrow_exception(error);
+}
+
+/** Writes every registered asset as a sprite sheet with its frames side
+ * by side, named after the array. */
+void export_assets(FileWriter & out)
+{
+    parallel_for(sizeof(assets) / sizeof(assets[0]), [&](size_t i)
+    {
+        Bitmap sheet = append_bitmaps(decode_asset(assets[i]));
+        out.write(std::string(assets[i].name) + ".png", encode_png(sheet));
+    });
+}
+
+#ifndef NO_MAGICK
+/** Copies encoded image data so it can be handed to a FileWriter */
+std::vector<uint8_t> blob_bytes(const Blob & blob)
+{
+    const uint8_t * data = static_cast<const uint8_t *>(blob.data());
+    return std::vector<uint8_t>(data, data + blob.length());
+}
+
+/** Extracts the 8-bit grayscale pixels of an image in row order */
+std::vector<uint8_t> gray_pixels(const Image & img)
+{
+    Image gray = img;
+    Blob blob;
+    gray.write(&blob, "GRAY", 8);
+    return blob_bytes(blob);
+}
+
+/** Extracts thresholded pixels (0 or 1) from an image in row order */
+std::vector<uint8_t> mono_pixels(const Image & img)
+{
+    std::vector<uint8_t> result = gray_pixels(img);
+    for (uint8_t & pixel : result)
+    {
+        pixel = pixel >= 0x80;
+    }
+    
+    return result;
+}
 
+/** Extracts the opaque pixels (0 or 1) of an image in row order */
+std::vector<uint8_t> alpha_pixels(const Image & img)
+{
+    std::vector<uint8_t> result(img.columns() * img.rows(), 1);
+    if (!img.matte()) return result;
+    
+    const PixelPacket * pixels = img.getConstPixels(0, 0, img.columns(), img.rows());
+    for (size_t i = 0; i < result.size(); i++)
+    {
+        result[i] = pixels[i].opacity < MaxRGB / 2;
+    }
+    
     return result;
 }
 
+/** Converts an image to a bitmap, keeping any transparency */
+Bitmap image_bitmap(const Image & img)
+{
+    Bitmap bitmap(img.columns(), img.rows());
+    bitmap.pixels = gray_pixels(img);
+    if (!img.matte()) return bitmap;
+    
+    bitmap.alpha = alpha_pixels(img);
+    for (uint8_t & opaque : bitmap.alpha)
+    {
+        opaque = opaque ? 0xFF : 0x00;
+    }
+    
+    return bitmap;
+}
+
+#endif
+
+/** Packs one 8-pixel high band of 0/1 pixels into Arduboy vertical bytes.
+ * This is the inverse of the inner loops of load_arduboy_frame: bit n of
+ * each output byte is the pixel n rows down in that column. */
+void pack_arduboy_band(const uint8_t * pixels, size_t stride, size_t width, uint8_t * out)
+{
+    size_t x = 0;
+#ifdef __SSE2__
+    /* 16 columns at a time: turn each row into a byte mask and keep only
+     * that row's bit, so OR-ing the rows gives the finished bytes */
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i packed = zero;
+        for (size_t ybit = 0; ybit < 8; ybit++)
+        {
+            __m128i row = _mm_loadu_si128((const __m128i *)(pixels + stride * ybit + x));
+            __m128i set = _mm_cmpgt_epi8(row, zero);
+            packed = _mm_or_si128(packed, _mm_and_si128(set, _mm_set1_epi8(1 << ybit)));
+        }
+        _mm_storeu_si128((__m128i *)(out + x), packed);
+    }
+#endif
+    for (; x < width; x++)
+    {
+        uint8_t outbyte = 0;
+        for (size_t ybit = 0; ybit < 8; ybit++)
+        {
+            outbyte |= (pixels[stride * ybit + x] != 0) << ybit;
+        }
+        out[x] = outbyte;
+    }
+}
+
+/** Encodes bitmaps as a multi-frame Arduboy sprite, with the width and
+ * height header, into result. Pixels and alpha of 0x80 and up are set.
+ * If plus_mask is set, the alpha is interleaved as a mask after every
+ * image byte (the *_plus_mask layout). Heights are padded to a multiple
+ * of 8, and later frames are cropped or padded to the size of the first.
+ * 
+ * Returns an error message, or null if the frames were encoded. */
+const char * encode_arduboy(const std::vector<Bitmap> & frames, std::vector<uint8_t> & result, bool plus_mask=false)
+{
+    if (frames.empty()) return "has no frames";
+    
+    const size_t width = frames[0].width;
+    const size_t height = (frames[0].height + 7) & ~7;
+    if (width == 0 || height == 0) return "is empty";
+    if (width > 255 || height > 255) return "is larger than 255 pixels, the most a sprite header can hold";
+    
+    result = {(uint8_t)width, (uint8_t)height};
+    std::vector<uint8_t> image(width * height);
+    std::vector<uint8_t> mask(width * height);
+    std::vector<uint8_t> band(width);
+    std::vector<uint8_t> maskband(width);
+    
+    for (const Bitmap & frame : frames)
+    {
+        std::fill(image.begin(), image.end(), 0);
+        std::fill(mask.begin(), mask.end(), 0);
+        for (size_t y = 0; y < frame.height && y < height; y++)
+        {
+            for (size_t x = 0; x < frame.width && x < width; x++)
+            {
+                size_t i = y * frame.width + x;
+                image[y * width + x] = frame.pixels[i] >= 0x80;
+                mask[y * width + x] = frame.alpha.empty() || frame.alpha[i] >= 0x80;
+            }
+        }
+        
+        for (size_t ybyte = 0; ybyte < height / 8; ybyte++)
+        {
+            pack_arduboy_band(&image[ybyte * 8 * width], width, width, band.data());
+            if (!plus_mask)
+            {
+                result.insert(result.end(), band.begin(), band.end());
+                continue;
+            }
+            
+            pack_arduboy_band(&mask[ybyte * 8 * width], width, width, maskband.data());
+            for (size_t x = 0; x < width; x++)
+            {
+                result.push_back(band[x]);
+                result.push_back(maskband[x]);
+            }
+        }
+    }
+    
+    return nullptr;
+}
+
+/** Checks that a registered asset comes back unchanged when it is
+ * encoded again and decoded, as --encode would write it */
+bool asset_round_trips(const AssetInfo & asset)
+{
+    std::vector<Bitmap> frames = decode_asset(asset);
+    std::vector<uint8_t> sprite;
+    bool masked = asset.layout == ASSET_PLUS_MASK;
+    if (encode_arduboy(frames, sprite, masked)) return false;
+    
+    std::vector<Bitmap> decoded = masked ? decode_arduboy_plus_mask(sprite.data(), sprite.size())
+                                         : decode_arduboy(sprite.data(), sprite.size());
+    if (decoded.size() != frames.size()) return false;
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        if (decoded[i].width != frames[i].width || decoded[i].height != frames[i].height ||
+            decoded[i].pixels != frames[i].pixels || decoded[i].alpha != frames[i].alpha)
+        {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/** Prints an encoded sprite as a C array in the same layout as bitmaps.h */
+void print_sprite(std::ostream & out, const std::string & name, const std::vector<uint8_t> & sprite, bool plus_mask=false)
+{
+    const size_t width = sprite[0];
+    const size_t height = sprite[1];
+    const size_t line = plus_mask ? width * 2 : width;
+    const size_t frame_size = line * height / 8;
+    char buf[8];
+    
+    out << "PROGMEM const unsigned char " << name << "[] = {" << std::endl;
+    out << "  // width, height" << std::endl;
+    out << "  " << width << ", " << height << "," << std::endl;
+    for (size_t i = 2; i < sprite.size(); i++)
+    {
+        size_t offset = i - 2;
+        if (offset % frame_size == 0)
+        {
+            out << "  // frame " << offset / frame_size << std::endl;
+        }
+        if (offset % line == 0) out << " ";
+        
+        snprintf(buf, sizeof(buf), " 0x%02X,", sprite[i]);
+        out << buf;
+        if (offset % line == line - 1) out << std::endl;
+    }
+    out << "};" << std::endl;
+}
+
+/* Sprite sheets that a display list can refer to */
+enum SpriteSet
+{
+    SPRITE_TILES,
+    SPRITE_KID,
+    SPRITE_WALKER,
+    SPRITE_FAN,
+    SPRITE_SPIKES,
+    SPRITE_DOOR,
+    SPRITE_ELEMENTS,
+    NUM_SPRITE_SETS
+};
+
+struct SpriteSource
+{
+    const uint8_t * data;   // starts with the frame size
+    size_t length;
+    bool inverted;          // stored with black and white swapped
+};
+
+/* Source data of each sprite set */
+static const SpriteSource sprite_sources[NUM_SPRITE_SETS] = {
+    {tileSetTwo, sizeof(tileSetTwo), false},
+    {kidSprite, sizeof(kidSprite), true},
+    {walkerSprite, sizeof(walkerSprite), false},
+    {fan, sizeof(fan), false},
+    {sprSpikes, sizeof(sprSpikes), false},
+    {door, sizeof(door), false},
+    {elements, sizeof(elements), false}
+};
+
+/* Decoded frames of each sprite set */
+static std::vector<Bitmap> sprite_bitmaps[NUM_SPRITE_SETS];
+
+void load_sprite_bitmaps()
+{
+    for (size_t set = 0; set < NUM_SPRITE_SETS; set++)
+    {
+        const SpriteSource & source = sprite_sources[set];
+        sprite_bitmaps[set] = decode_arduboy(source.data, source.length, source.inverted);
+    }
+}
+
+#ifndef NO_MAGICK
 /* Statically store key images to use when generating maps.
  * These will be assigned after init */
 static std::vector<Image> tiles;
@@ -86,12 +578,65 @@ static std::vector<Image> kid;
 static std::vector<Image> walker;
 static std::vector<Image> fanimg;
 static std::vector<Image> spikes;
-static std::vector<Image> key;
 static std::vector<Image> doorimg;
 static std::vector<Image> elemimg;
 
-/* Static loaded map so we can easily share among several subroutines */
-static uint8_t mapdata[LEVEL_WIDTH_CELLS][LEVEL_HEIGHT_CELLS] = {0};
+/* Loaded images of each sprite set */
+static std::vector<Image> * const sprite_images[NUM_SPRITE_SETS] = {
+    &tiles, &kid, &walker, &fanimg, &spikes, &doorimg, &elemimg
+};
+
+/** Starts GraphicsMagick and loads the sprite images. This is only done
+ * for the outputs that need Magick, as it dominates the start up time. */
+void init_magick(const char * path)
+{
+    static bool started = false;
+    if (started) return;
+    started = true;
+    
+    InitializeMagick(path);
+    for (size_t set = 0; set < NUM_SPRITE_SETS; set++)
+    {
+        *sprite_images[set] = bitmap_images(sprite_bitmaps[set]);
+    }
+}
+#endif
+
+/** One sprite frame drawn at a map pixel position */
+struct Blit
+{
+    uint8_t sprite;
+    uint8_t frame;
+    int16_t x;
+    int16_t y;
+    
+    bool operator!=(const Blit & other) const
+    {
+        return sprite != other.sprite || frame != other.frame ||
+               x != other.x || y != other.y;
+    }
+};
+
+/** Area of the map (in pixels) covered by a blit */
+Rect blit_box(const Blit & blit)
+{
+    const uint8_t * data = sprite_sources[blit.sprite].data;
+    return Rect{blit.x, blit.y, data[0], data[1]};
+}
+
+/** Everything needed to draw a level, without the work of decoding it:
+ * the tile frame of every cell, and the object sprites of each animation
+ * frame in drawing order. */
+struct DisplayList
+{
+    uint8_t tiles[LEVEL_HEIGHT_CELLS][LEVEL_WIDTH_CELLS];
+    uint32_t solid[LEVEL_HEIGHT_CELLS];     // bit x set for solid cells
+    std::vector<std::vector<Blit>> frames;
+};
+
+/* Static loaded map so we can easily share among several subroutines.
+ * Each thread has its own so levels can be rendered in parallel. */
+static thread_local uint8_t mapdata[LEVEL_WIDTH_CELLS][LEVEL_HEIGHT_CELLS] = {0};
 
 void load_map_cells(const uint8_t * map)
 {
@@ -141,97 +686,190 @@ int8_t gridGetTile(int8_t x, int8_t y)
     return f;
 }
 
+/* Number of frames in an animated map. This is the least common multiple
+ * of the coin (4), kid (4), fan (3) and walker (2) cycles so the loop
+ * is seamless. */
+static const size_t ANIM_FRAMES = 12;
+
+/* Delay between animation frames, in 1/100ths of a second */
+static const size_t ANIM_DELAY = 10;
+
+/* Marks the end of the object list */
+static const uint8_t LEVEL_END = 0xFF;
+
+/** Size of the object record starting with the given byte. Fans carry a
+ * third byte holding their direction and reach. */
+inline size_t object_size(uint8_t head)
+{
+    return 2 + ((head & 0xE0) == LFAN);
+}
+
+/** The objects of a level, decoded into one array per field so the
+ * draw order can be worked out without touching the other fields */
+struct ObjectTable
+{
+    std::vector<uint8_t> id;
+    std::vector<uint8_t> x;
+    std::vector<uint8_t> y;
+    std::vector<uint8_t> extra;
+    
+    size_t size() const
+    {
+        return id.size();
+    }
+};
+
 class ObjectPlacer
 {
     public:
-        ObjectPlacer(const uint8_t * map, size_t & i)
+        /** Places object n of the table */
+        ObjectPlacer(const ObjectTable & objects, size_t n)
         {
-            /* Extract parameters and increment position */
-            id = map[i] & 0xE0;
-            y = map[i] & 0x1F;
-            x = map[i+1] & 0x1F;
-            extra = map[i+1] >> 5;
-            
-            if (id == LFAN)
-            {
-                extra = map[i+2];
-                i += 3;
-            }
-            else i += 2;
+            id = objects.id[n];
+            x = objects.x[n];
+            y = objects.y[n];
+            extra = objects.extra[n];
         }
         
-        void draw(Image & img)
+        /** Adds the sprites of the object, in the given animation frame,
+         * to a display list */
+        void draw(std::vector<Blit> & blits, size_t frame=0)
         {
+            out = &blits;
+            anim = frame;
+            
             switch(id)
             {
             case LCOIN:
-                drawCoin(img);
+                drawCoin();
                 break;
             case LKEY:
-                drawKey(img);
+                drawKey();
                 break;
             case LSTART:
-                drawKid(img);
+                drawKid();
                 break;
             case LFINISH:
-                drawDoor(img);
+                drawDoor();
                 break;
             case LWALKER:
-                drawWalker(img);
+                drawWalker();
                 break;
             case LFAN:
-                drawFan(img);
+                drawFan();
                 break;
             case LSPIKES:
-                drawSpikes(img);
+                drawSpikes();
                 break;
             default:
                 break;
             }
         }
         
-    protected:
-        uint8_t id;
-        uint8_t y;
-        uint8_t x;
-        uint8_t extra;
-        
-        void drawCoin(Image & img)
-        {
-            img.composite(elemimg[0], 
-                x * LEVEL_CELLSIZE + 3, y * LEVEL_CELLSIZE, 
-                AtopCompositeOp);
-        }
-        
-        void drawKey(Image & img)
-        {
-            img.composite(elemimg[4], 
-                x * LEVEL_CELLSIZE + 3, y * LEVEL_CELLSIZE, 
-                AtopCompositeOp);
-        }
-        
-        void drawKid(Image & img)
-        {
-            img.composite(kid[0], 
-                x * LEVEL_CELLSIZE + 2, y * LEVEL_CELLSIZE, 
-                AtopCompositeOp);
-        }
-        
-        void drawDoor(Image & img)
-        {
-            img.composite(doorimg[0], 
-                x * LEVEL_CELLSIZE, y * LEVEL_CELLSIZE, 
-                AtopCompositeOp);
-        }
-        
-        void drawWalker(Image & img)
+        /** Area of the map (in pixels) covered by the object */
+        Rect bounds() const
         {
-            img.composite(walker[0], 
-                x * LEVEL_CELLSIZE + 4, y * LEVEL_CELLSIZE + 8, 
-                AtopCompositeOp);
+            ssize_t xpix = x * LEVEL_CELLSIZE;
+            ssize_t ypix = y * LEVEL_CELLSIZE;
+            
+            switch(id)
+            {
+            case LCOIN:
+            case LKEY:
+                return Rect{xpix + 3, ypix, 10, 16};
+            case LSTART:
+                return Rect{xpix + 2, ypix, 12, 16};
+            case LFINISH:
+            case LFAN:
+                return Rect{xpix, ypix, 16, 16};
+            case LWALKER:
+                return Rect{xpix + 4, ypix + 8, 8, 8};
+            case LSPIKES:
+            {
+                bool horiz;
+                size_t dir;
+                ssize_t len = 16 * (extra + 1);
+                spikeLayout(xpix, ypix, horiz, dir);
+                if (horiz) return Rect{xpix, ypix, len, 8};
+                else       return Rect{xpix, ypix, 8, len};
+            }
+            default:
+                return Rect{xpix, ypix, 0, 0};
+            }
+        }
+        
+        /** Direction a fan blows in: 0 for up, otherwise 1 for right or
+         * -1 for left */
+        int fanDirection() const
+        {
+            return (extra < 64) ? 0 : (extra < 192) ? 1 : -1;
+        }
+        
+        /** Area of the map (in pixels) a fan blows over, which is the
+         * given number of cells in front of it */
+        Rect fanArea() const
+        {
+            ssize_t xpix = x * LEVEL_CELLSIZE;
+            ssize_t ypix = y * LEVEL_CELLSIZE;
+            ssize_t reach = std::max(1, extra & 0x3F) * LEVEL_CELLSIZE;
+            
+            switch (fanDirection())
+            {
+            case 0:
+                return Rect{xpix, ypix - reach, LEVEL_CELLSIZE, reach};
+            case 1:
+                return Rect{xpix + LEVEL_CELLSIZE, ypix, reach, LEVEL_CELLSIZE};
+            default:
+                return Rect{xpix - reach, ypix, reach, LEVEL_CELLSIZE};
+            }
+        }
+        
+    protected:
+        uint8_t id;
+        uint8_t y;
+        uint8_t x;
+        uint8_t extra;
+        
+        /* Parameters of the current draw call */
+        std::vector<Blit> * out;
+        size_t anim;
+        
+        void blit(SpriteSet sprite, size_t frame, ssize_t xpix, ssize_t ypix)
+        {
+            out->push_back(Blit{(uint8_t)sprite, (uint8_t)frame, (int16_t)xpix, (int16_t)ypix});
+        }
+        
+        void drawCoin()
+        {
+            blit(SPRITE_ELEMENTS, anim % 4, 
+                x * LEVEL_CELLSIZE + 3, y * LEVEL_CELLSIZE);
+        }
+        
+        void drawKey()
+        {
+            blit(SPRITE_ELEMENTS, 4, 
+                x * LEVEL_CELLSIZE + 3, y * LEVEL_CELLSIZE);
+        }
+        
+        void drawKid()
+        {
+            blit(SPRITE_KID, anim % 4, 
+                x * LEVEL_CELLSIZE + 2, y * LEVEL_CELLSIZE);
+        }
+        
+        void drawDoor()
+        {
+            blit(SPRITE_DOOR, 0, 
+                x * LEVEL_CELLSIZE, y * LEVEL_CELLSIZE);
+        }
+        
+        void drawWalker()
+        {
+            blit(SPRITE_WALKER, anim % 2, 
+                x * LEVEL_CELLSIZE + 4, y * LEVEL_CELLSIZE + 8);
         }
         
-        void drawFan(Image & img)
+        void drawFan()
         {
             /* Default for upwards fans (< 64) */
             size_t imgidx = 0;
@@ -246,19 +884,15 @@ class ObjectPlacer
                 imgidx = 6;
             }
             
-            img.composite(fanimg[imgidx], 
-                x * LEVEL_CELLSIZE, y * LEVEL_CELLSIZE, 
-                AtopCompositeOp);
+            blit(SPRITE_FAN, imgidx + anim % 3, 
+                x * LEVEL_CELLSIZE, y * LEVEL_CELLSIZE);
         }
 
         /* Some parts of this adapted from enemies.h */
-        void drawSpikes(Image & img)
+        void spikeLayout(ssize_t & xpix, ssize_t & ypix, bool & horiz, size_t & dir) const
         {
-            bool horiz = false;
-            size_t dir = 0;
-            ssize_t xpix = x * LEVEL_CELLSIZE;
-            ssize_t ypix = y * LEVEL_CELLSIZE;
-            ssize_t len = 16 * (extra + 1);
+            horiz = false;
+            dir = 0;
 
             // Solid above
             if (gridGetSolid(x, y - 1))
@@ -280,143 +914,3331 @@ class ObjectPlacer
                 xpix += 8;
                 dir = 2;
             }
+        }
+
+        void drawSpikes()
+        {
+            bool horiz;
+            size_t dir;
+            ssize_t xpix = x * LEVEL_CELLSIZE;
+            ssize_t ypix = y * LEVEL_CELLSIZE;
+            ssize_t len = 16 * (extra + 1);
+
+            spikeLayout(xpix, ypix, horiz, dir);
             
             if (horiz)
             {
                 for (uint8_t xdot = 0; xdot < len; xdot += 8)
                 {
-                    img.composite(spikes[dir], xpix + xdot, ypix,
-                            AtopCompositeOp);
+                    blit(SPRITE_SPIKES, dir, xpix + xdot, ypix);
                 }
             }
             else
             {
                 for (uint8_t ydot = 0; ydot < len; ydot += 8)
                 {
-                    img.composite(spikes[dir], xpix, ypix + ydot,
-                            AtopCompositeOp);
+                    blit(SPRITE_SPIKES, dir, xpix, ypix + ydot);
                 }
             }
+        }
+        
+};
 
+/** Decodes the object list following the tile block of a map. Decoding
+ * stops at the end marker, or before a record that would run past the
+ * end of the data. */
+ObjectTable load_objects(const uint8_t * map, size_t length)
+{
+    ObjectTable objects;
+    size_t i = LEVEL_CELL_BYTES;
+    while (i < length && map[i] != LEVEL_END && i + object_size(map[i]) <= length)
+    {
+        uint8_t id = map[i] & 0xE0;
+        objects.id.push_back(id);
+        objects.y.push_back(map[i] & 0x1F);
+        objects.x.push_back(map[i+1] & 0x1F);
+        objects.extra.push_back((id == LFAN) ? map[i+2] : map[i+1] >> 5);
+        i += object_size(map[i]);
+    }
+    
+    return objects;
+}
 
+/** Works out an order to draw objects in, grouped by sprite so that each
+ * sprite is used for a run of blits in a row.
+ * 
+ * Objects only need to keep their file order where they overlap. Each
+ * object is given a wave one after the latest wave of the earlier objects
+ * it overlaps, so objects within a wave never overlap and can be sorted
+ * by type. Uses the currently loaded map for spike placement. */
+std::vector<size_t> draw_order(const ObjectTable & objects)
+{
+    std::vector<Rect> boxes;
+    for (size_t n = 0; n < objects.size(); n++)
+    {
+        boxes.push_back(ObjectPlacer(objects, n).bounds());
+    }
+    
+    std::vector<size_t> wave(objects.size(), 0);
+    for (size_t n = 0; n < objects.size(); n++)
+    {
+        for (size_t m = 0; m < n; m++)
+        {
+            if (boxes[n].overlaps(boxes[m]))
+            {
+                wave[n] = std::max(wave[n], wave[m] + 1);
+            }
+        }
+    }
+    
+    std::vector<size_t> order(objects.size());
+    for (size_t n = 0; n < order.size(); n++)
+    {
+        order[n] = n;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+    {
+        if (wave[a] != wave[b]) return wave[a] < wave[b];
+        return objects.id[a] < objects.id[b];
+    });
+    
+    return order;
+}
 
-
+/** Checks that a level can be rendered as intended: a complete tile
+ * block, then whole object records of known types placed inside the
+ * map, then the end marker. This only looks at the object list, once,
+ * so it is cheap enough to run on every level before rendering.
+ * 
+ * Returns nullptr for a valid level, otherwise what is wrong with it. */
+const char * validate_level(const uint8_t * map, size_t length)
+{
+    if (length <= LEVEL_CELL_BYTES)
+    {
+        return "shorter than the tile block";
+    }
+    
+    size_t i = LEVEL_CELL_BYTES;
+    while (i < length && map[i] != LEVEL_END)
+    {
+        size_t next = i + object_size(map[i]);
+        if (next > length)
+        {
+            return "object record runs past the end";
         }
         
-};
+        /* Unknown types and cells outside the map, all tested at once */
+        bool bad = ((map[i] & 0xE0) > LKEY) |
+                   ((map[i] & 0x1F) >= LEVEL_HEIGHT_CELLS) |
+                   ((map[i+1] & 0x1F) >= LEVEL_WIDTH_CELLS);
+        if (bad)
+        {
+            return "object outside the map or of unknown type";
+        }
+        i = next;
+    }
+    
+    if (i >= length)
+    {
+        return "missing end marker";
+    }
+    
+    return nullptr;
+}
 
-Image generate_map(const uint8_t * map, size_t length)
+/** Decodes a level into a display list with the given number of
+ * animation frames */
+DisplayList make_display_list(const uint8_t * map, size_t length, size_t frames=1)
 {
     /* Image format is a block of tile data, followed by
      * packged information on objects within the map.
      * 
      * Although the map has a scheme ending in 0xff, this
      * function still takes the array length as a parameter for safety */
-     
-    /* Load the map first, because we will eventually need to compare
-     * adjacent tiles when rendering. */
-     load_map_cells(map);
+    DisplayList list;
+    
+    /* Load the map first, because tiles and spikes depend on the
+     * adjacent cells. */
+    load_map_cells(map);
+    for (size_t y = 0; y < LEVEL_HEIGHT_CELLS; y++)
+    {
+        list.solid[y] = 0;
+        for (size_t x = 0; x < LEVEL_WIDTH_CELLS; x++)
+        {
+            list.tiles[y][x] = gridGetTile(x, y);
+            list.solid[y] |= (uint32_t)gridGetSolid(x, y) << x;
+        }
+    }
+    
+    ObjectTable objects = load_objects(map, length);
+    std::vector<size_t> order = draw_order(objects);
+    list.frames.resize(frames);
+    for (size_t frame = 0; frame < frames; frame++)
+    {
+        for (size_t n : order)
+        {
+            ObjectPlacer(objects, n).draw(list.frames[frame], frame);
+        }
+    }
     
-    /* Generate map image now */
+    return list;
+}
+
+#ifndef NO_MAGICK
+/** Renders the tile layer of a display list */
+Image render_tiles(const DisplayList & list)
+{
     Image mapimg(Geometry(LEVEL_WIDTH, LEVEL_HEIGHT), Color("white"));
     
     for (size_t y = 0; y < LEVEL_HEIGHT_CELLS; y++)
     {
         for (size_t x = 0; x < LEVEL_WIDTH_CELLS; x++)
         {
-            mapimg.composite(tiles[gridGetTile(x, y)], 
+            mapimg.composite(tiles[list.tiles[y][x]], 
                 x * LEVEL_CELLSIZE, y * LEVEL_CELLSIZE, 
-                AtopCompositeOp);
+                OverCompositeOp);
         }
     }
     
-    /* Now overlay objects onto the map image, ignoring the last 0xff position */
-    size_t i = LEVEL_CELL_BYTES;
-    while (i < length - 1)
+    return mapimg;
+}
+
+/** Composites blits onto an image. The origin is the map pixel position
+ * of the top-left corner of img, which allows drawing into a cropped
+ * region of the map. */
+void draw_blits(Image & img, const std::vector<Blit> & blits, ssize_t origin_x=0, ssize_t origin_y=0)
+{
+    for (const Blit & blit : blits)
     {
-        ObjectPlacer obj(map, i);
-        obj.draw(mapimg);        
+        img.composite((*sprite_images[blit.sprite])[blit.frame], 
+            blit.x - origin_x, blit.y - origin_y, OverCompositeOp);
     }
-    
+}
+
+/** Renders the first frame of a display list */
+Image render_map(const DisplayList & list)
+{
+    Image mapimg = render_tiles(list);
+    draw_blits(mapimg, list.frames[0]);
     return mapimg;
 }
 
-int main(int argc,char **argv)
-{ 
-    InitializeMagick(*argv);
-    
-    /* Load static sprites now */
-    tiles = load_arduboy(tileSetTwo, sizeof(tileSetTwo));
-    kid = load_arduboy(kidSprite, sizeof(kidSprite), true);
-    walker = load_arduboy(walkerSprite, sizeof(walkerSprite));
-    fanimg = load_arduboy(fan, sizeof(fan));
-    spikes = load_arduboy(sprSpikes, sizeof(sprSpikes));
-    doorimg = load_arduboy(door, sizeof(door));
-    elemimg = load_arduboy(elements, sizeof(elements));
-    
-    /* Re-combine the title screen image */
-    std::vector<Image> title = load_arduboy(titleScreen, sizeof(titleScreen));
-    Image completeTitle;
-    appendImages(&completeTitle, title.begin(), title.end());
-    completeTitle.write("title.png");
-
-    /* Save sprites to disk to confirm behaviour */
-    writeImages(kid.begin(), kid.end(), "kidSprite.gif");
-    writeImages(walker.begin(), walker.end(), "walkerSprite.gif");
-    writeImages(spikes.begin(), spikes.end(), "sprSpikes.gif");
-    writeImages(fanimg.begin(), fanimg.end(), "fan.gif");
-    writeImages(tiles.begin(), tiles.end(), "tileSetTwo.gif");
-    writeImages(doorimg.begin(), doorimg.end(), "door.gif");
-    writeImages(elemimg.begin(), elemimg.end(), "elements.gif");
+Image generate_map(const uint8_t * map, size_t length)
+{
+    return render_map(make_display_list(map, length));
+}
+
+/** Smallest rectangle covering both a and b */
+Rect union_box(const Rect & a, const Rect & b)
+{
+    ssize_t left = std::min(a.x, b.x);
+    ssize_t top = std::min(a.y, b.y);
+    ssize_t right = std::max(a.x + a.width, b.x + b.width);
+    ssize_t bottom = std::max(a.y + a.height, b.y + b.height);
+    return Rect{left, top, right - left, bottom - top};
+}
+
+/** Finds the parts of an animated display list that change: one box per
+ * animated object, covering it in every frame, with boxes that overlap
+ * merged until none do. Every frame has the same objects in the same
+ * order, so blits line up. */
+std::vector<Rect> changed_boxes(const DisplayList & list)
+{
+    const std::vector<Blit> & still = list.frames[0];
+    std::vector<Rect> boxes;
+    for (size_t i = 0; i < still.size(); i++)
+    {
+        bool changes = false;
+        Rect box = blit_box(still[i]);
+        for (const std::vector<Blit> & blits : list.frames)
+        {
+            changes |= blits[i] != still[i];
+            box = union_box(box, blit_box(blits[i]));
+        }
+        if (!changes) continue;
+        
+        /* Take in every box this one overlaps, then look again, as the
+         * bigger box may now reach others */
+        for (size_t n = 0; n < boxes.size();)
+        {
+            if (!boxes[n].overlaps(box))
+            {
+                n++;
+                continue;
+            }
+            box = union_box(box, boxes[n]);
+            boxes.erase(boxes.begin() + n);
+            n = 0;
+        }
+        boxes.push_back(box);
+    }
     
-    /* Generate map images.
-     * Note: Not all maps are used (even numbered ones), and some non-numbered ones are
-     * used in the primary sequence. */
-    generate_map(level1, sizeof(level1)).write("level1.png");
-    generate_map(level1old, sizeof(level1old)).write("level1disabled.png");
-    generate_map(level2, sizeof(level2)).write("level2.png");
-    generate_map(level3, sizeof(level3)).write("level3.png");
-    generate_map(level4, sizeof(level4)).write("level4.png");
-    generate_map(level5, sizeof(level5)).write("level5.png");
-    generate_map(level6, sizeof(level6)).write("level6.png");
-    generate_map(level7, sizeof(level7)).write("level7.png");
-    generate_map(level8, sizeof(level8)).write("level8.png");
-    generate_map(level9, sizeof(level9)).write("level9.png");
-    generate_map(level10, sizeof(level10)).write("level10.png");
-    generate_map(jace, sizeof(jace)).write("jace.png");
-    generate_map(testhfan, sizeof(testhfan)).write("testhfan.png");
-    generate_map(level11hard, sizeof(level11hard)).write("level11hard.png");
-    generate_map(level11, sizeof(level11)).write("level11.png"); // hard mode level 11
-    generate_map(level12, sizeof(level12)).write("level12.png");
-    generate_map(level13, sizeof(level13)).write("level13.png");
-    generate_map(level14, sizeof(level14)).write("level14.png");
-    generate_map(level15, sizeof(level15)).write("level15.png");
-    generate_map(level16, sizeof(level16)).write("level16.png");
-    generate_map(level17, sizeof(level17)).write("level17.png");
-    generate_map(level18, sizeof(level18)).write("level18.png");
-    generate_map(level19, sizeof(level19)).write("level19.png");
-    generate_map(level20, sizeof(level20)).write("level20.png");
-    generate_map(level21, sizeof(level21)).write("level21.png");
-    generate_map(level22, sizeof(level22)).write("level22.png");
-    generate_map(level23, sizeof(level23)).write("level23.png");
-    generate_map(level24, sizeof(level24)).write("level24.png");
-    generate_map(level25, sizeof(level25)).write("level25.png");
-    generate_map(level26, sizeof(level26)).write("level26.png");
-    generate_map(level27, sizeof(level27)).write("level27.png");
-    generate_map(level28, sizeof(level28)).write("level28.png");
-    generate_map(level29, sizeof(level29)).write("level29.png");
-    generate_map(level30, sizeof(level30)).write("level30.png");
-    generate_map(level31, sizeof(level31)).write("level31.png");
-    generate_map(level32, sizeof(level32)).write("level32.png");
-    generate_map(level33, sizeof(level33)).write("level33.png");
-    generate_map(level34, sizeof(level34)).write("level34.png");
-    generate_map(level35, sizeof(level35)).write("level35.png");
-    generate_map(level36, sizeof(level36)).write("level36.png");
-    generate_map(level37, sizeof(level37)).write("level37.png");
-    generate_map(level38, sizeof(level38)).write("level38.png");
-    generate_map(level39, sizeof(level39)).write("level39.png");
-    generate_map(level40, sizeof(level40)).write("level40.png");
-    generate_map(levelNarrowWalls, sizeof(levelNarrowWalls)).write("levelNarrowWalls.png");
-
-    return 0;
+    return boxes;
+}
+
+/** Renders an animated display list as a list of GIF frames.
+ * 
+ * The tile layer is only rendered once. The first frame is the complete
+ * map. Every following frame spans the boxes of the animated objects and
+ * is transparent between them, so only the pixels in those boxes are
+ * redrawn over the previous frame. */
+std::vector<Image> render_animated_map(const DisplayList & list)
+{
+    Image tilelayer = render_tiles(list);
+    
+    std::vector<Image> frames;
+    Image first = tilelayer;
+    draw_blits(first, list.frames[0]);
+    first.animationDelay(ANIM_DELAY);
+    first.animationIterations(0);
+    first.gifDisposeMethod(1);
+    frames.push_back(first);
+    
+    std::vector<Rect> boxes = changed_boxes(list);
+    if (boxes.empty())
+    {
+        /* Nothing moves, so a single frame is enough */
+        return frames;
+    }
+    
+    Rect changed = boxes[0];
+    std::vector<Image> backgrounds;
+    for (const Rect & box : boxes)
+    {
+        changed = union_box(changed, box);
+        backgrounds.push_back(tilelayer);
+        backgrounds.back().crop(Geometry(box.width, box.height, box.x, box.y));
+    }
+    Geometry region(changed.width, changed.height, changed.x, changed.y);
+    
+    for (size_t frame = 1; frame < list.frames.size(); frame++)
+    {
+        Image delta(Geometry(changed.width, changed.height), Color("transparent"));
+        for (size_t b = 0; b < boxes.size(); b++)
+        {
+            /* Only blits touching the box need to be redrawn. Keep them in
+             * order so overlapping objects stack the same as the still map. */
+            std::vector<Blit> touching;
+            for (const Blit & blit : list.frames[frame])
+            {
+                if (blit_box(blit).overlaps(boxes[b]))
+                {
+                    touching.push_back(blit);
+                }
+            }
+            
+            Image piece = backgrounds[b];
+            draw_blits(piece, touching, boxes[b].x, boxes[b].y);
+            delta.composite(piece, boxes[b].x - changed.x, boxes[b].y - changed.y, CopyCompositeOp);
+        }
+        delta.page(region);
+        delta.animationDelay(ANIM_DELAY);
+        delta.gifDisposeMethod(1);
+        frames.push_back(delta);
+    }
+    
+    return frames;
+}
+#endif
+
+/** Identifies a row of tiles. The tiles of a row only depend on which
+ * cells are solid in it and in the rows directly above and below, as the
+ * columns outside the map always count as solid. */
+struct TileRowKey
+{
+    uint32_t above;
+    uint32_t row;
+    uint32_t below;
+    
+    bool operator==(const TileRowKey & other) const
+    {
+        return above == other.above && row == other.row && below == other.below;
+    }
+};
+
+struct TileRowHash
+{
+    size_t operator()(const TileRowKey & key) const
+    {
+        uint64_t hash = ((uint64_t)key.above << 24 | key.row) * 0x9E3779B97F4A7C15ULL;
+        return hash ^ (key.below * 0xC2B2AE3D27D4EB4FULL);
+    }
+};
+
+/* Drawn tile rows, each LEVEL_WIDTH x LEVEL_CELLSIZE pixels. Floors, sky
+ * and shafts repeat within and across levels, so most rows are copied
+ * from here rather than drawn tile by tile. Each thread has its own. */
+static thread_local std::unordered_map<TileRowKey, std::vector<uint8_t>, TileRowHash> tile_rows;
+
+/* Number of rows kept before the cache starts over */
+static const size_t TILE_ROW_CACHE_SIZE = 4096;
+
+/** Draws row y of the tile layer of a display list into a map bitmap */
+void draw_tile_row(const DisplayList & list, size_t y, Bitmap & bitmap)
+{
+    const size_t strip = LEVEL_WIDTH * LEVEL_CELLSIZE;
+    uint8_t * out = &bitmap.pixels[y * strip];
+    
+    TileRowKey key = {
+        y > 0 ? list.solid[y - 1] : 0,
+        list.solid[y],
+        y + 1 < LEVEL_HEIGHT_CELLS ? list.solid[y + 1] : 0
+    };
+    auto found = tile_rows.find(key);
+    if (found != tile_rows.end())
+    {
+        memcpy(out, found->second.data(), strip);
+        return;
+    }
+    
+    for (size_t x = 0; x < LEVEL_WIDTH_CELLS; x++)
+    {
+        bitmap.blit(sprite_bitmaps[SPRITE_TILES][list.tiles[y][x]], 
+            x * LEVEL_CELLSIZE, y * LEVEL_CELLSIZE);
+    }
+    
+    if (tile_rows.size() >= TILE_ROW_CACHE_SIZE) tile_rows.clear();
+    tile_rows.emplace(key, std::vector<uint8_t>(out, out + strip));
+}
+
+/** Draws the first frame of a display list without Magick */
+Bitmap render_bitmap(const DisplayList & list)
+{
+    Bitmap bitmap(LEVEL_WIDTH, LEVEL_HEIGHT);
+    for (size_t y = 0; y < LEVEL_HEIGHT_CELLS; y++)
+    {
+        draw_tile_row(list, y, bitmap);
+    }
+    for (const Blit & blit : list.frames[0])
+    {
+        bitmap.blit(sprite_bitmaps[blit.sprite][blit.frame], blit.x, blit.y);
+    }
+    
+    return bitmap;
+}
+
+/** SVG path data of a sprite frame: its black pixels and its opaque white
+ * pixels, each traced as one pixel wide strokes along the rows */
+struct SvgSymbol
+{
+    std::string black;
+    std::string white;
+};
+
+/* Traced frames of each sprite set, assigned after init when writing SVG */
+static std::vector<SvgSymbol> svg_symbols[NUM_SPRITE_SETS];
+
+static bool opaque(const Bitmap & bitmap, size_t i)
+{
+    return bitmap.alpha.empty() || bitmap.alpha[i] >= 0x80;
+}
+
+/** Traces a sprite frame into SVG path data */
+SvgSymbol trace_svg_symbol(const Bitmap & bitmap)
+{
+    size_t width = bitmap.width;
+    size_t height = bitmap.height;
+    
+    SvgSymbol symbol;
+    char buf[64];
+    for (size_t y = 0; y < height; y++)
+    {
+        size_t x = 0;
+        while (x < width)
+        {
+            size_t i = y * width + x;
+            if (!opaque(bitmap, i))
+            {
+                x++;
+                continue;
+            }
+            
+            bool white = bitmap.pixels[i] >= 0x80;
+            size_t run = 1;
+            while (x + run < width && opaque(bitmap, i + run) && (bitmap.pixels[i + run] >= 0x80) == white)
+            {
+                run++;
+            }
+            snprintf(buf, sizeof(buf), "M%zu %zu.5h%zu", x, y, run);
+            (white ? symbol.white : symbol.black) += buf;
+            x += run;
+        }
+    }
+    
+    return symbol;
+}
+
+void load_svg_symbols()
+{
+    for (size_t set = 0; set < NUM_SPRITE_SETS; set++)
+    {
+        for (const Bitmap & frame : sprite_bitmaps[set])
+        {
+            svg_symbols[set].push_back(trace_svg_symbol(frame));
+        }
+    }
+    
+    /* Tiles never overlap and the background is already white */
+    for (SvgSymbol & symbol : svg_symbols[SPRITE_TILES])
+    {
+        symbol.white.clear();
+    }
+}
+
+/** Writes the first frame of a display list as SVG. Every sprite frame
+ * that is used is defined once as a symbol and then placed with <use>,
+ * skipping tiles with nothing to draw. */
+std::string render_svg(const DisplayList & list)
+{
+    std::vector<bool> used[NUM_SPRITE_SETS];
+    for (size_t set = 0; set < NUM_SPRITE_SETS; set++)
+    {
+        used[set].resize(svg_symbols[set].size(), false);
+    }
+    for (size_t y = 0; y < LEVEL_HEIGHT_CELLS; y++)
+    {
+        for (size_t x = 0; x < LEVEL_WIDTH_CELLS; x++)
+        {
+            used[SPRITE_TILES][list.tiles[y][x]] = true;
+        }
+    }
+    for (const Blit & blit : list.frames[0])
+    {
+        used[blit.sprite][blit.frame] = true;
+    }
+    
+    std::string svg;
+    char buf[128];
+    snprintf(buf, sizeof(buf), "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" ",
+        LEVEL_WIDTH, LEVEL_HEIGHT);
+    svg += buf;
+    snprintf(buf, sizeof(buf), "viewBox=\"0 0 %d %d\" shape-rendering=\"crispEdges\">\n"
+        "<rect width=\"%d\" height=\"%d\" fill=\"#fff\"/>\n<defs>\n",
+        LEVEL_WIDTH, LEVEL_HEIGHT, LEVEL_WIDTH, LEVEL_HEIGHT);
+    svg += buf;
+    
+    for (size_t set = 0; set < NUM_SPRITE_SETS; set++)
+    {
+        for (size_t frame = 0; frame < used[set].size(); frame++)
+        {
+            const SvgSymbol & symbol = svg_symbols[set][frame];
+            if (!used[set][frame]) continue;
+            
+            snprintf(buf, sizeof(buf), "<symbol id=\"s%zu_%zu\" overflow=\"visible\">", set, frame);
+            svg += buf;
+            if (!symbol.black.empty()) svg += "<path stroke=\"#000\" d=\"" + symbol.black + "\"/>";
+            if (!symbol.white.empty()) svg += "<path stroke=\"#fff\" d=\"" + symbol.white + "\"/>";
+            svg += "</symbol>\n";
+        }
+    }
+    svg += "</defs>\n";
+    
+    for (size_t y = 0; y < LEVEL_HEIGHT_CELLS; y++)
+    {
+        for (size_t x = 0; x < LEVEL_WIDTH_CELLS; x++)
+        {
+            uint8_t tile = list.tiles[y][x];
+            if (svg_symbols[SPRITE_TILES][tile].black.empty()) continue;
+            
+            snprintf(buf, sizeof(buf), "<use href=\"#s%d_%d\" x=\"%zu\" y=\"%zu\"/>\n",
+                SPRITE_TILES, tile, x * LEVEL_CELLSIZE, y * LEVEL_CELLSIZE);
+            svg += buf;
+        }
+    }
+    for (const Blit & blit : list.frames[0])
+    {
+        snprintf(buf, sizeof(buf), "<use href=\"#s%d_%d\" x=\"%d\" y=\"%d\"/>\n",
+            blit.sprite, blit.frame, blit.x, blit.y);
+        svg += buf;
+    }
+    svg += "</svg>\n";
+    
+    return svg;
+}
+
+/* Level flags, as detected by registry.awk */
+enum LevelFlags
+{
+    LEVEL_ENABLED = 1,  // part of the game's levels[] play order
+    LEVEL_HARD = 2      // hard mode variant
+};
+
+struct LevelInfo
+{
+    const char * name;
+    const uint8_t * data;
+    size_t length;
+    int sequence;       // position in the play order, or -1
+    unsigned flags;
+};
+
+/* Every level in bitmaps.h, in file order */
+static const LevelInfo level_registry[] = {
+#define ASSET(name, width, height, layout)
+#define LEVEL(name, sequence, flags) {#name, name, sizeof(name), sequence, flags},
+#include "registry.inc"
+#undef ASSET
+#undef LEVEL
+};
+static const size_t num_levels = sizeof(level_registry) / sizeof(level_registry[0]);
+
+/** Looks up a level by its exact name, or returns nullptr */
+const LevelInfo * find_level(const std::string & name)
+{
+    for (size_t i = 0; i < num_levels; i++)
+    {
+        if (name == level_registry[i].name) return &level_registry[i];
+    }
+    return nullptr;
+}
+
+/** Selects levels from the registry. Each selector is a level name or
+ * glob pattern (level1*), a position or range of positions in the play
+ * order counting from 1 (5, 10-20), or "game" for the whole play order.
+ * Levels are returned in the order selected, without duplicates. An
+ * empty list selects every level in file order.
+ * 
+ * Returns false if a selector does not match anything. */
+bool select_levels(const std::vector<std::string> & selectors, std::vector<size_t> & selected)
+{
+    std::vector<bool> used(num_levels, false);
+    auto add = [&](size_t i)
+    {
+        if (!used[i]) selected.push_back(i);
+        used[i] = true;
+    };
+    
+    if (selectors.empty())
+    {
+        for (size_t i = 0; i < num_levels; i++) add(i);
+        return true;
+    }
+    
+    for (const std::string & sel : selectors)
+    {
+        size_t before = selected.size();
+        unsigned first, last;
+        char dash;
+        int fields = sscanf(sel.c_str(), "%u%c%u", &first, &dash, &last);
+        
+        if (sel == "game" || (fields == 1 && sel.find_first_not_of("0123456789") == std::string::npos) ||
+            (fields == 3 && dash == '-'))
+        {
+            if (sel == "game")
+            {
+                first = 1;
+                last = num_levels;
+            }
+            else if (fields == 1)
+            {
+                last = first;
+            }
+            
+            for (unsigned pos = first; pos <= last; pos++)
+            {
+                for (size_t i = 0; i < num_levels; i++)
+                {
+                    if (level_registry[i].sequence == (int)pos - 1) add(i);
+                }
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < num_levels; i++)
+            {
+                if (fnmatch(sel.c_str(), level_registry[i].name, 0) == 0) add(i);
+            }
+        }
+        
+        if (selected.size() == before)
+        {
+            std::cerr << "No level matches " << sel << std::endl;
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/** Selects levels of a pack by exact name, found through the name hashes
+ * in its index, or by position in the pack counting from 1 (5, 10-20).
+ * An empty list selects the whole pack. Returns false if a selector does
+ * not match anything. */
+bool select_pack_levels(const LevelPack & pack, const std::vector<std::string> & selectors, std::vector<size_t> & selected)
+{
+    if (selectors.empty())
+    {
+        for (size_t i = 0; i < pack.size(); i++) selected.push_back(i);
+        return true;
+    }
+    
+    for (const std::string & sel : selectors)
+    {
+        size_t before = selected.size();
+        unsigned long first, last;
+        char dash;
+        int fields = sscanf(sel.c_str(), "%lu%c%lu", &first, &dash, &last);
+        
+        if ((fields == 1 && sel.find_first_not_of("0123456789") == std::string::npos) ||
+            (fields == 3 && dash == '-'))
+        {
+            if (fields == 1) last = first;
+            for (size_t pos = std::max(first, 1ul); pos <= std::min<size_t>(last, pack.size()); pos++)
+            {
+                selected.push_back(pos - 1);
+            }
+        }
+        else
+        {
+            size_t found = pack.find(sel);
+            if (found < pack.size()) selected.push_back(found);
+        }
+        
+        if (selected.size() == before)
+        {
+            std::cerr << "No level in the pack matches " << sel << std::endl;
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/** Picks out one shard of the selected levels, so that n processes can
+ * share the work without talking to each other. Levels are weighed by
+ * their size in bytes, which grows with their object count, and handed
+ * out largest first, each to the shard with the least work so far (ties
+ * go to the earlier level and the lower shard). Every process works out
+ * the same split. The shard keeps the levels in their selected order. */
+std::vector<size_t> shard_levels(const std::vector<size_t> & selected, const std::vector<size_t> & costs,
+                                 size_t shard, size_t shards)
+{
+    std::vector<size_t> order(selected.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+    
+    std::vector<size_t> load(shards, 0);
+    std::vector<bool> mine(selected.size(), false);
+    for (size_t i : order)
+    {
+        size_t least = std::min_element(load.begin(), load.end()) - load.begin();
+        load[least] += costs[i];
+        mine[i] = (least == shard);
+    }
+    
+    std::vector<size_t> kept;
+    for (size_t i = 0; i < selected.size(); i++)
+    {
+        if (mine[i]) kept.push_back(selected[i]);
+    }
+    return kept;
+}
+
+/** Level i of the pack, or of the registry without one. The name of a
+ * pack level is kept in name, which must outlive the result, and pack
+ * levels are not in the play order. */
+LevelInfo source_level(const LevelPack * pack, size_t i, std::string & name)
+{
+    if (!pack)
+    {
+        name = level_registry[i].name;
+        return level_registry[i];
+    }
+    
+    name = pack->name(i);
+    LevelInfo level = {name.c_str(), nullptr, 0, -1, 0};
+    level.data = pack->level(i, level.length);
+    return level;
+}
+
+/** Returns a file name without the directory or extension */
+std::string file_stem(const std::string & file)
+{
+    std::string name = file.substr(file.find_last_of('/') + 1);
+    return name.substr(0, name.find('.'));
+}
+
+/* Route planning works on whole cells, which the kid's body fills. Moves
+ * are weighed by roughly how many frames they take in play. */
+static const uint32_t ROUTE_WALK = 16;
+static const uint32_t ROUTE_FALL = 6;
+static const uint32_t ROUTE_JUMP = 8;           // per cell of height
+static const uint32_t ROUTE_FAN = 8;            // per cell lifted by a fan
+static const uint32_t ROUTE_FLOAT = 16;         // per cell across or up on the balloon
+static const uint32_t ROUTE_MAX_COST = 16;
+static const size_t ROUTE_JUMP_CELLS = 2;       // height of a jump
+static const size_t ROUTE_AIR_CELLS = 10;        // cells the balloon carries between landings
+
+/* A search node is a cell, whether the kid stands in it or halfway into
+ * the next cell to the right, whether the key has been taken, how much
+ * jump is left and how much balloon air is left. Standing halfway lets the
+ * kid pass between spikes on both walls of a two cell wide shaft. */
+static const size_t ROUTE_ABOVE = 1;            // rows above the level, which is open at the top
+static const size_t ROUTE_CELLS = LEVEL_WIDTH_CELLS * (LEVEL_HEIGHT_CELLS + ROUTE_ABOVE);
+static const size_t ROUTE_NODES = 2 * ROUTE_CELLS * 2 * ROUTE_JUMP_CELLS * (ROUTE_AIR_CELLS + 1);
+static const uint16_t ROUTE_NONE = 0xFFFF;
+static_assert(ROUTE_NODES < ROUTE_NONE, "route nodes must fit in 16 bits");
+
+inline uint16_t route_cell(ssize_t x, ssize_t y)
+{
+    return (y + ROUTE_ABOVE) * LEVEL_WIDTH_CELLS + x;
+}
+
+inline ssize_t route_cell_x(uint16_t cell)
+{
+    return cell % LEVEL_WIDTH_CELLS;
+}
+
+inline ssize_t route_cell_y(uint16_t cell)
+{
+    return (ssize_t)(cell / LEVEL_WIDTH_CELLS) - ROUTE_ABOVE;
+}
+
+/** The shortest route through a level, from the start through the key
+ * (if there is one) to the door */
+struct Route
+{
+    bool found;
+    const char * error;         // why there is no route
+    uint32_t frames;            // estimated time taken
+    size_t keystep;             // index of the step where the key is taken
+    std::vector<uint16_t> cells;    // route_cell() * 2 of each step, plus 1 when halfway right
+};
+
+/** Dijkstra's search over the cells of the current map, using Dial's
+ * buckets since every move costs at most ROUTE_MAX_COST. All of its state
+ * lives in fixed arrays, one set per thread, so planning a route does not
+ * allocate. */
+class RoutePlanner
+{
+    public:
+        Route plan(const uint8_t * map, size_t length)
+        {
+            Route route = {false, nullptr, 0, 0, {}};
+            load_map_cells(map);
+            ObjectTable objects = load_objects(map, length);
+            
+            memset(blocked, 0, sizeof(blocked));
+            memset(targets, 0, sizeof(targets));
+            memset(fans, 0, sizeof(fans));
+            ssize_t start = -1;
+            bool haskey = false;
+            std::vector<Rect> spikes;
+            for (size_t n = 0; n < objects.size(); n++)
+            {
+                ObjectPlacer obj(objects, n);
+                switch (objects.id[n])
+                {
+                case LSTART:
+                    start = route_cell(objects.x[n], objects.y[n]);
+                    break;
+                case LSPIKES:
+                    spikes.push_back(obj.bounds());
+                    break;
+                case LKEY:
+                    mark(obj.bounds(), targets, TARGET_KEY);
+                    haskey = true;
+                    break;
+                case LFINISH:
+                    mark(obj.bounds(), targets, TARGET_DOOR);
+                    break;
+                case LFAN:
+                    mark(obj.fanArea(), fans, 1 << (obj.fanDirection() + 1));
+                    break;
+                default:
+                    break;
+                }
+            }
+            if (start < 0)
+            {
+                route.error = "no start";
+                return route;
+            }
+            
+            /* Spikes block the places where they would touch the kid */
+            for (size_t cell = 0; cell < ROUTE_CELLS; cell++)
+            {
+                for (size_t half = 0; half < 2; half++)
+                {
+                    Rect kid = {route_cell_x(cell) * LEVEL_CELLSIZE + (ssize_t)half * LEVEL_CELLSIZE / 2 + 2,
+                                route_cell_y(cell) * LEVEL_CELLSIZE, 12, LEVEL_CELLSIZE};
+                    for (const Rect & spike : spikes)
+                    {
+                        if (kid.overlaps(spike)) blocked[cell] |= 1 << half;
+                    }
+                }
+            }
+            
+            /* Without a key, every search node already counts as holding it */
+            bool keyfirst = !haskey || (targets[start] & TARGET_KEY);
+            uint16_t goal = search(node(keyfirst, start, 0, 0, ROUTE_AIR_CELLS));
+            if (goal == ROUTE_NONE)
+            {
+                route.error = (haskey && !key_reached) ? "no route to the key found by the cell model" :
+                                                         "no route to the door found by the cell model";
+                return route;
+            }
+            
+            route.found = true;
+            route.frames = dist[goal];
+            size_t keyfromend = 0;
+            for (uint16_t n = goal; n != ROUTE_NONE; n = parent[n])
+            {
+                route.cells.push_back(cell_of(n) * 2 + half_of(n));
+                if (parent[n] != ROUTE_NONE && !key_of(parent[n]) && key_of(n))
+                {
+                    keyfromend = route.cells.size();
+                }
+            }
+            std::reverse(route.cells.begin(), route.cells.end());
+            route.keystep = keyfromend ? route.cells.size() - keyfromend : 0;
+            return route;
+        }
+        
+    protected:
+        enum
+        {
+            TARGET_KEY = 1,
+            TARGET_DOOR = 2
+        };
+        
+        /* Fan flags per cell, indexed by fanDirection() + 1 */
+        enum
+        {
+            FAN_LEFT = 1,
+            FAN_UP = 2,
+            FAN_RIGHT = 4
+        };
+        
+        uint8_t blocked[ROUTE_CELLS];       // bit 0 in the cell, bit 1 halfway right
+        uint8_t targets[ROUTE_CELLS];
+        uint8_t fans[ROUTE_CELLS];
+        
+        uint32_t dist[ROUTE_NODES];
+        uint16_t parent[ROUTE_NODES];
+        uint16_t next[ROUTE_NODES];         // doubly linked bucket lists
+        uint16_t prev[ROUTE_NODES];
+        uint16_t buckets[ROUTE_MAX_COST + 1];
+        bool done[ROUTE_NODES];
+        bool key_reached;
+        
+        static uint16_t node(size_t key, size_t cell, size_t half, size_t rise, size_t air)
+        {
+            return (((key * ROUTE_CELLS + cell) * 2 + half) * ROUTE_JUMP_CELLS + rise) * (ROUTE_AIR_CELLS + 1) + air;
+        }
+        
+        static size_t air_of(uint16_t n)   { return n % (ROUTE_AIR_CELLS + 1); }
+        static size_t rise_of(uint16_t n)  { return n / (ROUTE_AIR_CELLS + 1) % ROUTE_JUMP_CELLS; }
+        static size_t half_of(uint16_t n)  { return n / (ROUTE_AIR_CELLS + 1) / ROUTE_JUMP_CELLS % 2; }
+        static size_t cell_of(uint16_t n)  { return n / (ROUTE_AIR_CELLS + 1) / ROUTE_JUMP_CELLS / 2 % ROUTE_CELLS; }
+        static size_t key_of(uint16_t n)   { return n / (ROUTE_AIR_CELLS + 1) / ROUTE_JUMP_CELLS / 2 / ROUTE_CELLS; }
+        
+        /** Sets a flag on every cell a pixel rectangle touches */
+        static void mark(const Rect & area, uint8_t * cells, uint8_t flag)
+        {
+            for (ssize_t y = std::max<ssize_t>(-(ssize_t)ROUTE_ABOVE, area.y / LEVEL_CELLSIZE);
+                 y < std::min<ssize_t>(LEVEL_HEIGHT_CELLS, (area.y + area.height + LEVEL_CELLSIZE - 1) / LEVEL_CELLSIZE); y++)
+            {
+                for (ssize_t x = std::max<ssize_t>(0, area.x / LEVEL_CELLSIZE);
+                     x < std::min<ssize_t>(LEVEL_WIDTH_CELLS, (area.x + area.width + LEVEL_CELLSIZE - 1) / LEVEL_CELLSIZE); x++)
+                {
+                    cells[route_cell(x, y)] |= flag;
+                }
+            }
+        }
+        
+        /** True if the kid fits in the cell, or halfway between it and the
+         * next one */
+        bool open(ssize_t x, ssize_t y, size_t half=0) const
+        {
+            return x >= 0 && x + (ssize_t)half < LEVEL_WIDTH_CELLS && y >= -(ssize_t)ROUTE_ABOVE && y < LEVEL_HEIGHT_CELLS &&
+                   !gridGetSolid(x, y) && !(half && gridGetSolid(x + 1, y)) && !(blocked[route_cell(x, y)] & (1 << half));
+        }
+        
+        static bool grounded(ssize_t x, ssize_t y, size_t half=0)
+        {
+            return gridGetSolid(x, y + 1) || (half && gridGetSolid(x + 1, y + 1));
+        }
+        
+        /** Flags of the cells the kid is in */
+        static uint8_t touched(const uint8_t * cells, ssize_t x, ssize_t y, size_t half)
+        {
+            return cells[route_cell(x, y)] | (half ? cells[route_cell(x + 1, y)] : 0);
+        }
+        
+        void unlink(uint16_t n)
+        {
+            uint16_t & head = buckets[dist[n] % (ROUTE_MAX_COST + 1)];
+            if (prev[n] != ROUTE_NONE) next[prev[n]] = next[n];
+            else                       head = next[n];
+            if (next[n] != ROUTE_NONE) prev[next[n]] = prev[n];
+        }
+        
+        void push(uint16_t n, uint32_t d, uint16_t from)
+        {
+            if (done[n] || d >= dist[n]) return;
+            if (dist[n] != UINT32_MAX) unlink(n);
+            
+            dist[n] = d;
+            parent[n] = from;
+            uint16_t & head = buckets[d % (ROUTE_MAX_COST + 1)];
+            prev[n] = ROUTE_NONE;
+            next[n] = head;
+            if (head != ROUTE_NONE) prev[head] = n;
+            head = n;
+        }
+        
+        /** Moves from node n into the cell (x, y), or halfway past it,
+         * landing if there is ground below */
+        void move(uint16_t n, ssize_t x, ssize_t y, size_t half, size_t rise, size_t air, uint32_t cost)
+        {
+            if (!open(x, y, half)) return;
+            
+            size_t key = key_of(n) | ((touched(targets, x, y, half) & TARGET_KEY) != 0);
+            if (grounded(x, y, half))
+            {
+                rise = 0;
+                air = ROUTE_AIR_CELLS;
+            }
+            push(node(key, route_cell(x, y), half, rise, air), dist[n] + cost, n);
+        }
+        
+        /** Moves from node n half a cell to the left or right */
+        void step(uint16_t n, ssize_t x, ssize_t y, size_t half, int dir, size_t rise, size_t air, uint32_t cost)
+        {
+            if (dir > 0) move(n, x + (ssize_t)half, y, !half, rise, air, cost);
+            else         move(n, x - !half, y, !half, rise, air, cost);
+        }
+        
+        /** Runs the search, returning the first node to reach the door
+         * holding the key, or ROUTE_NONE */
+        uint16_t search(uint16_t from)
+        {
+            std::fill(dist, dist + ROUTE_NODES, UINT32_MAX);
+            std::fill(done, done + ROUTE_NODES, false);
+            std::fill(buckets, buckets + ROUTE_MAX_COST + 1, ROUTE_NONE);
+            key_reached = false;
+            push(from, 0, ROUTE_NONE);
+            
+            /* Stops once a full turn of the buckets finds nothing queued */
+            uint32_t d = 0;
+            size_t empty = 0;
+            while (empty <= ROUTE_MAX_COST)
+            {
+                uint16_t n = buckets[d % (ROUTE_MAX_COST + 1)];
+                if (n == ROUTE_NONE)
+                {
+                    empty++;
+                    d++;
+                    continue;
+                }
+                empty = 0;
+                
+                unlink(n);
+                done[n] = true;
+                
+                size_t cell = cell_of(n);
+                size_t half = half_of(n);
+                ssize_t x = route_cell_x(cell);
+                ssize_t y = route_cell_y(cell);
+                key_reached |= key_of(n);
+                if (key_of(n) && (touched(targets, x, y, half) & TARGET_DOOR)) return n;
+                
+                size_t rise = rise_of(n);
+                size_t air = air_of(n);
+                if (grounded(x, y, half))
+                {
+                    move(n, x - 1, y, half, 0, air, ROUTE_WALK);
+                    move(n, x + 1, y, half, 0, air, ROUTE_WALK);
+                    step(n, x, y, half, -1, 0, air, ROUTE_WALK / 2);
+                    step(n, x, y, half, 1, 0, air, ROUTE_WALK / 2);
+                    move(n, x, y - 1, half, ROUTE_JUMP_CELLS - 1, air, ROUTE_JUMP);
+                }
+                else
+                {
+                    move(n, x, y + 1, half, rise, air, ROUTE_FALL);
+                    if (rise) move(n, x, y - 1, half, rise - 1, air, ROUTE_JUMP);
+                    if (air)
+                    {
+                        move(n, x, y - 1, half, rise, air - 1, ROUTE_FLOAT);
+                        move(n, x - 1, y, half, rise, air - 1, ROUTE_FLOAT);
+                        move(n, x + 1, y, half, rise, air - 1, ROUTE_FLOAT);
+                        step(n, x, y, half, -1, rise, air - 1, ROUTE_FLOAT / 2);
+                        step(n, x, y, half, 1, rise, air - 1, ROUTE_FLOAT / 2);
+                        if (open(x - 1, y, half)) move(n, x - 1, y + 1, half, 0, air - 1, ROUTE_FLOAT);
+                        if (open(x + 1, y, half)) move(n, x + 1, y + 1, half, 0, air - 1, ROUTE_FLOAT);
+                    }
+                }
+                
+                uint8_t fan = touched(fans, x, y, half);
+                if (fan & FAN_UP)    move(n, x, y - 1, half, rise, air, ROUTE_FAN);
+                if (fan & FAN_LEFT)  move(n, x - 1, y, half, rise, air, ROUTE_WALK);
+                if (fan & FAN_RIGHT) move(n, x + 1, y, half, rise, air, ROUTE_WALK);
+            }
+            
+            return ROUTE_NONE;
+        }
+};
+
+static thread_local RoutePlanner route_planner;
+
+/** Plans the shortest route through a level; see RoutePlanner */
+Route plan_route(const uint8_t * map, size_t length)
+{
+    return route_planner.plan(map, length);
+}
+
+/** Draws a route over a map as a black line with a white outline, joining
+ * the centres of its cells. Steps above the level are left off. */
+void draw_route(Bitmap & bitmap, const Route & route)
+{
+    for (int pass = 0; pass < 2; pass++)
+    {
+        ssize_t half = pass ? 1 : 2;
+        uint8_t colour = pass ? 0x00 : 0xFF;
+        for (size_t i = 0; i < route.cells.size(); i++)
+        {
+            ssize_t x1 = route_cell_x(route.cells[i] / 2) * LEVEL_CELLSIZE + (route.cells[i] % 2 + 1) * LEVEL_CELLSIZE / 2;
+            ssize_t y1 = route_cell_y(route.cells[i] / 2) * LEVEL_CELLSIZE + LEVEL_CELLSIZE / 2;
+            size_t j = i + (i + 1 < route.cells.size());
+            ssize_t x2 = route_cell_x(route.cells[j] / 2) * LEVEL_CELLSIZE + (route.cells[j] % 2 + 1) * LEVEL_CELLSIZE / 2;
+            ssize_t y2 = route_cell_y(route.cells[j] / 2) * LEVEL_CELLSIZE + LEVEL_CELLSIZE / 2;
+            
+            /* Consecutive cells are neighbours, so the line is straight or
+             * diagonal */
+            ssize_t steps = std::max(std::abs(x2 - x1), std::abs(y2 - y1));
+            for (ssize_t s = 0; s <= steps; s++)
+            {
+                ssize_t px = x1 + (steps ? (x2 - x1) * s / steps : 0);
+                ssize_t py = y1 + (steps ? (y2 - y1) * s / steps : 0);
+                for (ssize_t y = std::max<ssize_t>(0, py - half); y < py + half; y++)
+                {
+                    for (ssize_t x = px - half; x < px + half; x++)
+                    {
+                        bitmap.pixels[y * bitmap.width + x] = colour;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Output formats for maps */
+enum MapFormat
+{
+    MAP_PNG,
+    MAP_QOI,    // lossless like PNG, but quick to encode and decode
+    MAP_PBM,    // uncompressed, 1 bit per pixel
+    MAP_PGM,    // uncompressed, 8 bits per pixel
+    MAP_GIF,    // animated
+    MAP_SVG,
+    MAP_TTY,    // printed to the terminal with half-blocks
+    MAP_SIXEL   // printed to the terminal as sixel graphics
+};
+
+/* Selected output format for maps */
+static MapFormat map_format = MAP_PNG;
+
+/** True if maps are written as still images from a drawn bitmap */
+static bool raster_format()
+{
+    return map_format == MAP_PNG || map_format == MAP_QOI || map_format == MAP_PBM || map_format == MAP_PGM;
+}
+
+/** Encodes a drawn map (or poster) in the selected still image format,
+ * adding the file extension to name */
+std::vector<uint8_t> encode_image(const Bitmap & bitmap, std::string & name)
+{
+    switch (map_format)
+    {
+    case MAP_QOI:
+        name += ".qoi";
+        return encode_qoi(bitmap);
+    case MAP_PBM:
+        name += ".pbm";
+        return encode_pbm(bitmap);
+    case MAP_PGM:
+        name += ".pgm";
+        return encode_pgm(bitmap);
+    default:
+        name += ".png";
+        return encode_png(bitmap);
+    }
+}
+
+/** Describes a planned route in one line */
+std::string describe_route(const std::string & name, const Route & route)
+{
+    if (!route.found) return name + ": " + route.error;
+    
+    char buf[128];
+    snprintf(buf, sizeof(buf), ": %zu steps, about %u frames", route.cells.size() - 1, route.frames);
+    std::string text = name + buf;
+    if (route.keystep)
+    {
+        snprintf(buf, sizeof(buf), ", key after %zu steps", route.keystep);
+        text += buf;
+    }
+    return text;
+}
+
+/** Encodes a single map and queues it to be written to disk, named
+ * after the level. If route is given, the shortest route through the
+ * level is drawn on the map and described in it. */
+void write_map(const uint8_t * map, size_t length, const std::string & name, FileWriter & out, std::string * route=nullptr)
+{
+    if (const char * error = validate_level(map, length))
+    {
+        std::cerr << name << ": invalid level, " << error << std::endl;
+        return;
+    }
+    
+    switch (map_format)
+    {
+#ifndef NO_MAGICK
+    case MAP_GIF:
+    {
+        Blob blob;
+        std::vector<Image> frames = render_animated_map(make_display_list(map, length, ANIM_FRAMES));
+        for (Image & frame : frames)
+        {
+            frame.magick("GIF");
+        }
+        writeImages(frames.begin(), frames.end(), &blob);
+        out.write(name + ".gif", blob_bytes(blob));
+        break;
+    }
+#endif
+    case MAP_SVG:
+    {
+        std::string svg = render_svg(make_display_list(map, length));
+        out.write(name + ".svg", std::vector<uint8_t>(svg.begin(), svg.end()));
+        break;
+    }
+    default:
+    {
+        Bitmap bitmap = render_bitmap(make_display_list(map, length));
+        if (route)
+        {
+            Route planned = plan_route(map, length);
+            draw_route(bitmap, planned);
+            *route = describe_route(name, planned);
+        }
+        std::string file = name;
+        std::vector<uint8_t> data = encode_image(bitmap, file);
+        out.write(file, std::move(data));
+        break;
+    }
+    }
+}
+
+/** Prints the selected levels to the terminal in order, without Magick.
+ * When reading from and writing to a terminal, waits for Enter between
+ * levels, so a whole set of levels can be paged through. Levels come
+ * from the pack if one is given, or else from the registry. */
+void show_levels(const std::vector<size_t> & selected, const LevelPack * pack)
+{
+    /* Scale the half-block view down to fit the terminal */
+    size_t scale = 1;
+    while (LEVEL_WIDTH / scale > tty_columns())
+    {
+        scale++;
+    }
+    
+    bool paging = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) && selected.size() > 1;
+    for (size_t i = 0; i < selected.size(); i++)
+    {
+        std::string name;
+        const LevelInfo level = source_level(pack, selected[i], name);
+        if (const char * error = validate_level(level.data, level.length))
+        {
+            std::cerr << level.name << ": invalid level, " << error << std::endl;
+            continue;
+        }
+        
+        Bitmap bitmap = render_bitmap(make_display_list(level.data, level.length));
+        std::cout << level.name << std::endl;
+        std::cout << (map_format == MAP_SIXEL ? tty_sixel(bitmap) : tty_blocks(bitmap, scale));
+        
+        if (paging && i + 1 < selected.size())
+        {
+            std::cout << "-- " << i + 1 << "/" << selected.size() << ", Enter for the next level, q to quit --" << std::flush;
+            std::string reply;
+            if (!std::getline(std::cin, reply) || reply == "q") break;
+        }
+    }
+}
+
+/* Poster layout, in pixels */
+static const size_t POSTER_MARGIN = 16;
+static const size_t POSTER_LABEL = 16;          // strip above each map
+static const size_t POSTER_LABEL_SCALE = 2;
+
+/** Draws the selected levels in a grid, each labelled with its position
+ * in the play order and its name, and queues the result as poster.png.
+ * Levels come from the pack if one is given, or else from the registry.
+ * Every level is drawn in parallel into its own part of one canvas, which
+ * is then encoded once; long labels are cut short to stay in their part. */
+void write_poster(const std::vector<size_t> & selected, const LevelPack * pack, FileWriter & out)
+{
+    size_t columns = 1;
+    while (columns * columns < selected.size())
+    {
+        columns++;
+    }
+    const size_t rows = (selected.size() + columns - 1) / columns;
+    const size_t cellwidth = LEVEL_WIDTH + POSTER_MARGIN;
+    const size_t cellheight = POSTER_LABEL + LEVEL_HEIGHT + POSTER_MARGIN;
+    Bitmap poster(columns * cellwidth + POSTER_MARGIN, rows * cellheight + POSTER_MARGIN);
+    
+    parallel_for(selected.size(), [&](size_t i)
+    {
+        std::string name;
+        const LevelInfo level = source_level(pack, selected[i], name);
+        size_t x = POSTER_MARGIN + (i % columns) * cellwidth;
+        size_t y = POSTER_MARGIN + (i / columns) * cellheight;
+        
+        std::string label = level.name;
+        if (level.sequence >= 0) label = std::to_string(level.sequence + 1) + " " + label;
+        draw_text(poster, x, y, label, POSTER_LABEL_SCALE, cellwidth - POSTER_MARGIN);
+        
+        if (const char * error = validate_level(level.data, level.length))
+        {
+            std::cerr << level.name << ": invalid level, " << error << std::endl;
+            return;
+        }
+        poster.blit(render_bitmap(make_display_list(level.data, level.length)), x, y + POSTER_LABEL);
+    });
+    
+    std::string file = "poster";
+    std::vector<uint8_t> data = encode_image(poster, file);
+    out.write(file, std::move(data));
+}
+
+/* Layers of the pack heatmap */
+enum HeatLayer
+{
+    HEAT_SOLID,
+    HEAT_SPIKES,
+    HEAT_COINS,
+    NUM_HEAT_LAYERS
+};
+
+static const char * const heat_layer_names[NUM_HEAT_LAYERS] = {"solid", "spikes", "coins"};
+
+static const size_t HEAT_MARGIN = 16;
+static const size_t HEAT_LABEL = 16;            // strip above each panel
+static const size_t HEAT_LEGEND = 32;           // colour bar and its range below each panel
+static const size_t HEAT_BAR = 8;
+static const size_t HEAT_TEXT_SCALE = 2;
+
+/** Per-cell counts over a set of levels */
+struct HeatCounts
+{
+    uint32_t cells[NUM_HEAT_LAYERS][LEVEL_HEIGHT_CELLS][LEVEL_WIDTH_CELLS] = {};
+    size_t levels = 0;
+    size_t invalid = 0;
+    
+    /** Adds the solid cells, the cells touched by spikes and the coins of
+     * a level */
+    void add(const uint8_t * map, size_t length)
+    {
+        if (validate_level(map, length))
+        {
+            invalid++;
+            return;
+        }
+        levels++;
+        
+        for (size_t y = 0; y < LEVEL_HEIGHT_CELLS; y++)
+        {
+            for (size_t x = 0; x < LEVEL_WIDTH_CELLS; x++)
+            {
+                cells[HEAT_SOLID][y][x] += (map[x / 8 + y * LEVEL_WIDTH_CELLS / 8] >> (x % 8)) & 1;
+            }
+        }
+        
+        /* Spikes are laid out against the walls around them */
+        load_map_cells(map);
+        ObjectTable objects = load_objects(map, length);
+        for (size_t n = 0; n < objects.size(); n++)
+        {
+            if (objects.id[n] == LCOIN && objects.y[n] < LEVEL_HEIGHT_CELLS && objects.x[n] < LEVEL_WIDTH_CELLS)
+            {
+                cells[HEAT_COINS][objects.y[n]][objects.x[n]]++;
+            }
+            if (objects.id[n] != LSPIKES) continue;
+            
+            Rect box = ObjectPlacer(objects, n).bounds();
+            ssize_t right = std::min<ssize_t>(LEVEL_WIDTH_CELLS, (box.x + box.width + LEVEL_CELLSIZE - 1) / LEVEL_CELLSIZE);
+            ssize_t bottom = std::min<ssize_t>(LEVEL_HEIGHT_CELLS, (box.y + box.height + LEVEL_CELLSIZE - 1) / LEVEL_CELLSIZE);
+            for (ssize_t y = box.y / LEVEL_CELLSIZE; y < bottom; y++)
+            {
+                for (ssize_t x = box.x / LEVEL_CELLSIZE; x < right; x++)
+                {
+                    cells[HEAT_SPIKES][y][x]++;
+                }
+            }
+        }
+    }
+    
+    void merge(const HeatCounts & other)
+    {
+        for (size_t layer = 0; layer < NUM_HEAT_LAYERS; layer++)
+        {
+            for (size_t y = 0; y < LEVEL_HEIGHT_CELLS; y++)
+            {
+                for (size_t x = 0; x < LEVEL_WIDTH_CELLS; x++)
+                {
+                    cells[layer][y][x] += other.cells[layer][y][x];
+                }
+            }
+        }
+        levels += other.levels;
+        invalid += other.invalid;
+    }
+};
+
+/** Colour for a count relative to the highest one, running from black
+ * through purple and orange to pale yellow */
+static void heat_colour(uint32_t count, uint32_t most, uint8_t * rgb)
+{
+    static const uint8_t stops[][3] = {{0, 0, 0}, {120, 28, 109}, {237, 105, 37}, {252, 255, 164}};
+    static const size_t last = sizeof(stops) / sizeof(stops[0]) - 1;
+    
+    double t = most ? (double)count / most * last : 0;
+    size_t stop = std::min<size_t>(t, last - 1);
+    double f = t - stop;
+    for (size_t c = 0; c < 3; c++)
+    {
+        rgb[c] = (uint8_t)(stops[stop][c] + (stops[stop + 1][c] - stops[stop][c]) * f + 0.5);
+    }
+}
+
+/** Counts, for every cell, how many of the selected levels have it solid,
+ * covered by spikes or holding a coin, and queues the counts side by side
+ * as colour-mapped panels in heatmap.png. Levels come from the pack if one
+ * is given, or else from the registry.
+ * 
+ * Levels are split into a few runs per thread, each counted into its own
+ * totals, so threads never share a counter; the totals are added up once
+ * at the end. Memory use does not grow with the number of levels. */
+void write_heatmap(const std::vector<size_t> & selected, const LevelPack * pack, FileWriter & out)
+{
+    const size_t runs = std::min(selected.size(), jobs * 4);
+    std::vector<HeatCounts> partial(runs);
+    parallel_for(runs, [&](size_t run)
+    {
+        for (size_t i = run * selected.size() / runs; i < (run + 1) * selected.size() / runs; i++)
+        {
+            if (pack)
+            {
+                size_t length;
+                const uint8_t * data = pack->level(selected[i], length);
+                partial[run].add(data, length);
+                continue;
+            }
+            
+            const LevelInfo & level = level_registry[selected[i]];
+            partial[run].add(level.data, level.length);
+        }
+    });
+    
+    HeatCounts total;
+    for (const HeatCounts & counts : partial)
+    {
+        total.merge(counts);
+    }
+    if (total.invalid)
+    {
+        std::cerr << "Left " << total.invalid << " invalid levels out of the heatmap" << std::endl;
+    }
+    
+    /* Labels go on a grayscale canvas first, which is then coloured in */
+    const size_t panelwidth = LEVEL_WIDTH + HEAT_MARGIN;
+    Bitmap canvas(NUM_HEAT_LAYERS * panelwidth + HEAT_MARGIN,
+                  HEAT_MARGIN + HEAT_LABEL + LEVEL_HEIGHT + HEAT_LEGEND + HEAT_MARGIN);
+    std::vector<uint32_t> most(NUM_HEAT_LAYERS, 0);
+    for (size_t layer = 0; layer < NUM_HEAT_LAYERS; layer++)
+    {
+        for (size_t y = 0; y < LEVEL_HEIGHT_CELLS; y++)
+        {
+            for (size_t x = 0; x < LEVEL_WIDTH_CELLS; x++)
+            {
+                most[layer] = std::max(most[layer], total.cells[layer][y][x]);
+            }
+        }
+        
+        size_t left = HEAT_MARGIN + layer * panelwidth;
+        size_t legend = HEAT_MARGIN + HEAT_LABEL + LEVEL_HEIGHT + HEAT_BAR * 2;
+        std::string range = std::to_string(most[layer]);
+        draw_text(canvas, left, HEAT_MARGIN, std::string(heat_layer_names[layer]) + " in " +
+                  std::to_string(total.levels) + " levels", HEAT_TEXT_SCALE);
+        draw_text(canvas, left, legend, "0", HEAT_TEXT_SCALE);
+        draw_text(canvas, left + LEVEL_WIDTH - range.size() * (FONT_WIDTH + 1) * HEAT_TEXT_SCALE + HEAT_TEXT_SCALE,
+                  legend, range, HEAT_TEXT_SCALE);
+    }
+    
+    std::vector<uint8_t> rgb(canvas.pixels.size() * 3);
+    for (size_t i = 0; i < canvas.pixels.size(); i++)
+    {
+        rgb[i * 3] = rgb[i * 3 + 1] = rgb[i * 3 + 2] = canvas.pixels[i];
+    }
+    auto fill = [&](size_t x, size_t y, size_t width, size_t height, const uint8_t * colour)
+    {
+        for (size_t row = y; row < y + height; row++)
+        {
+            for (size_t col = x; col < x + width; col++)
+            {
+                memcpy(&rgb[(row * canvas.width + col) * 3], colour, 3);
+            }
+        }
+    };
+    
+    for (size_t layer = 0; layer < NUM_HEAT_LAYERS; layer++)
+    {
+        size_t left = HEAT_MARGIN + layer * panelwidth;
+        size_t top = HEAT_MARGIN + HEAT_LABEL;
+        uint8_t colour[3];
+        for (size_t y = 0; y < LEVEL_HEIGHT_CELLS; y++)
+        {
+            for (size_t x = 0; x < LEVEL_WIDTH_CELLS; x++)
+            {
+                heat_colour(total.cells[layer][y][x], most[layer], colour);
+                fill(left + x * LEVEL_CELLSIZE, top + y * LEVEL_CELLSIZE, LEVEL_CELLSIZE, LEVEL_CELLSIZE, colour);
+            }
+        }
+        for (size_t x = 0; x < LEVEL_WIDTH; x++)
+        {
+            heat_colour(x, LEVEL_WIDTH - 1, colour);
+            fill(left + x, top + LEVEL_HEIGHT + HEAT_BAR / 2, 1, HEAT_BAR, colour);
+        }
+    }
+    
+    out.write("heatmap.png", encode_png_rgb(canvas.width, canvas.height, rgb));
+}
+
+/* Share of features two levels need in common to be reported as similar */
+static const double SIMILAR_THRESHOLD = 0.4;
+
+/** Prints the selected levels that are similar to the target level, most
+ * similar first, or with no target every group of similar levels, one
+ * group per line. Levels come from the pack if one is given, or else
+ * from the registry; the target need not be among the selected levels.
+ * 
+ * Levels are compared through MinHash signatures of their tile rows and
+ * objects, which are computed in parallel and bucketed by bands, so a
+ * pack is never compared pair by pair. */
+bool find_similar(const std::vector<size_t> & selected, const LevelPack * pack, const std::string & target)
+{
+    auto name = [&](size_t i) -> std::string
+    {
+        return pack ? pack->name(i) : level_registry[i].name;
+    };
+    auto signature = [&](size_t i)
+    {
+        if (!pack) return level_signature(level_registry[i].data, level_registry[i].length);
+        size_t length;
+        const uint8_t * data = pack->level(i, length);
+        return level_signature(data, length);
+    };
+    
+    std::vector<Signature> signatures(selected.size());
+    parallel_for(selected.size(), [&](size_t i)
+    {
+        signatures[i] = signature(selected[i]);
+    });
+    SimilarityIndex index(std::move(signatures));
+    
+    if (target.empty())
+    {
+        for (const std::vector<size_t> & group : index.clusters(SIMILAR_THRESHOLD))
+        {
+            for (size_t n = 0; n < group.size(); n++)
+            {
+                std::cout << (n ? "\t" : "") << name(selected[group[n]]);
+            }
+            std::cout << std::endl;
+        }
+        return true;
+    }
+    
+    const LevelInfo * level = pack ? nullptr : find_level(target);
+    size_t found = pack ? pack->find(target) : level ? level - level_registry : num_levels;
+    if (found == (pack ? pack->size() : num_levels))
+    {
+        std::cerr << "No level named " << target << std::endl;
+        return false;
+    }
+    for (const std::pair<size_t, double> & match : index.similar(signature(found), SIMILAR_THRESHOLD))
+    {
+        if (selected[match.first] == found) continue;
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%.2f", match.second);
+        std::cout << name(selected[match.first]) << "\t" << buf << std::endl;
+    }
+    return true;
+}
+
+/* Kid physics for replays, in 1/16 pixel units and 60 frames a second.
+ * The game's movement code is not part of this tool, so these values
+ * only approximate how the kid, balloon, fans and walkers feel in play.
+ * A replay that completes here says nothing about the real game; this
+ * is for sketching routes and driving --viewport, not for proving that
+ * a level can be finished. */
+static const int32_t SIM_SUBPIXELS = 16;
+static const int32_t SIM_WALK = 16;             // 1 pixel per frame
+static const int32_t SIM_JUMP = -72;
+static const int32_t SIM_GRAVITY = 4;
+static const int32_t SIM_MAX_FALL = 48;
+static const int32_t SIM_FLOAT_FALL = 8;        // fall speed while holding the balloon
+static const int32_t SIM_BALLOON_AIR = 120;     // frames of floating between landings
+static const int32_t SIM_FAN_LIFT = 10;         // upward acceleration over a fan
+static const int32_t SIM_FAN_RISE = -32;        // fastest rise over a fan
+static const int32_t SIM_FAN_PUSH = 12;         // sideways push of a fan
+static const int32_t SIM_WALKER_SPEED = 8;
+static const long SIM_MAX_FRAMES = 1 << 24;     // of input in a replay, about 3 days
+
+/* Buttons held in a replay frame */
+enum ReplayButtons
+{
+    BUTTON_LEFT = 1,
+    BUTTON_RIGHT = 2,
+    BUTTON_A = 4        // jump, or float on the balloon in the air
+};
+
+enum SimOutcome
+{
+    SIM_COMPLETED,
+    SIM_SPIKES,
+    SIM_WALKER,
+    SIM_FELL,
+    SIM_OUT_OF_INPUT
+};
+
+struct SimResult
+{
+    SimOutcome outcome;
+    size_t frames;
+    size_t coins;
+    bool key;
+    ssize_t x;          // kid position in pixels when the run ended
+    ssize_t y;
+};
+
+/** Runs recorded input against a level without drawing anything. All
+ * positions are fixed point, so a replay always has the same result.
+ * Uses the currently loaded map, like the renderer, so each thread can
+ * run its own replays. */
+class Simulator
+{
+    public:
+        Simulator(const uint8_t * map, size_t length)
+        {
+            load_map_cells(map);
+            ObjectTable objects = load_objects(map, length);
+            
+            keyneeded = false;
+            door = Rect{-1, -1, 0, 0};
+            startx = starty = 0;
+            for (size_t n = 0; n < objects.size(); n++)
+            {
+                ObjectPlacer obj(objects, n);
+                Rect box = obj.bounds();
+                ssize_t cellx = objects.x[n] * LEVEL_CELLSIZE;
+                ssize_t celly = objects.y[n] * LEVEL_CELLSIZE;
+                
+                switch (objects.id[n])
+                {
+                case LSTART:
+                    startx = (cellx + 2) * SIM_SUBPIXELS;
+                    starty = celly * SIM_SUBPIXELS;
+                    break;
+                case LFINISH:
+                    door = box;
+                    break;
+                case LKEY:
+                    keybox = box;
+                    keyneeded = true;
+                    break;
+                case LCOIN:
+                    coinboxes.push_back(box);
+                    break;
+                case LSPIKES:
+                    spikeboxes.push_back(box);
+                    break;
+                case LWALKER:
+                    walkers.push_back(Walker{(int32_t)box.x * SIM_SUBPIXELS, (int32_t)box.y * SIM_SUBPIXELS, 1});
+                    break;
+                case LFAN:
+                    fans.push_back(Fan{obj.fanArea(), obj.fanDirection()});
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+        
+        /** Plays one button mask per frame from the start of the level,
+         * adding the kid's body after each frame to trail if given */
+        SimResult run(const std::vector<uint8_t> & input, std::vector<Rect> * trail=nullptr)
+        {
+            x = startx;
+            y = starty;
+            vx = vy = 0;
+            air = SIM_BALLOON_AIR;
+            std::vector<Walker> active = walkers;
+            std::vector<bool> taken(coinboxes.size(), false);
+            
+            SimResult result = {SIM_OUT_OF_INPUT, 0, 0, false, 0, 0};
+            uint8_t previous = 0;
+            for (uint8_t buttons : input)
+            {
+                result.frames++;
+                step(buttons, previous);
+                previous = buttons;
+                
+                for (Walker & walker : active)
+                {
+                    stepWalker(walker);
+                }
+                
+                Rect kid = box();
+                result.x = kid.x;
+                result.y = kid.y;
+                if (trail) trail->push_back(kid);
+                if (kid.y >= LEVEL_HEIGHT)
+                {
+                    result.outcome = SIM_FELL;
+                    return result;
+                }
+                for (const Rect & spikes : spikeboxes)
+                {
+                    if (kid.overlaps(spikes))
+                    {
+                        result.outcome = SIM_SPIKES;
+                        return result;
+                    }
+                }
+                for (const Walker & walker : active)
+                {
+                    Rect body{walker.x / SIM_SUBPIXELS, walker.y / SIM_SUBPIXELS, 8, 8};
+                    if (kid.overlaps(body))
+                    {
+                        result.outcome = SIM_WALKER;
+                        return result;
+                    }
+                }
+                for (size_t i = 0; i < coinboxes.size(); i++)
+                {
+                    if (!taken[i] && kid.overlaps(coinboxes[i]))
+                    {
+                        taken[i] = true;
+                        result.coins++;
+                    }
+                }
+                result.key |= keyneeded && kid.overlaps(keybox);
+                if (kid.overlaps(door) && (result.key || !keyneeded))
+                {
+                    result.outcome = SIM_COMPLETED;
+                    return result;
+                }
+            }
+            
+            return result;
+        }
+        
+    protected:
+        struct Walker
+        {
+            int32_t x;
+            int32_t y;
+            int32_t dir;
+        };
+        
+        struct Fan
+        {
+            Rect area;
+            int32_t dir;    // 0 blows up, otherwise right (1) or left (-1)
+        };
+        
+        int32_t startx;
+        int32_t starty;
+        bool keyneeded;
+        Rect keybox;
+        Rect door;
+        std::vector<Rect> coinboxes;
+        std::vector<Rect> spikeboxes;
+        std::vector<Walker> walkers;
+        std::vector<Fan> fans;
+        
+        /* Kid state during a run */
+        int32_t x;
+        int32_t y;
+        int32_t vx;
+        int32_t vy;
+        int32_t air;
+        
+        static int32_t pixel(int32_t sub)
+        {
+            return (sub >= 0) ? sub / SIM_SUBPIXELS : -((-sub + SIM_SUBPIXELS - 1) / SIM_SUBPIXELS);
+        }
+        
+        static int32_t cell(int32_t pix)
+        {
+            return (pix >= 0) ? pix / LEVEL_CELLSIZE : -1;
+        }
+        
+        /** The kid's body, in pixels: the 12x16 kid sprite */
+        Rect box() const
+        {
+            return Rect{pixel(x), pixel(y), 12, 16};
+        }
+        
+        /** True if the kid would overlap a solid cell at (sx, sy) */
+        bool blocked(int32_t sx, int32_t sy) const
+        {
+            int32_t left = pixel(sx), top = pixel(sy);
+            for (int32_t cy = cell(top); cy <= cell(top + 15); cy++)
+            {
+                for (int32_t cx = cell(left); cx <= cell(left + 11); cx++)
+                {
+                    if (gridGetSolid(std::max(-1, std::min(cx, (int32_t)LEVEL_WIDTH_CELLS)),
+                                     std::max(-1, std::min(cy, (int32_t)LEVEL_HEIGHT_CELLS)))) return true;
+                }
+            }
+            return false;
+        }
+        
+        /** Moves along one axis until the kid would hit something.
+         * Returns false if the move was cut short. */
+        bool move(int32_t & pos, int32_t delta, bool horizontal)
+        {
+            int32_t dir = (delta > 0) ? 1 : -1;
+            while (delta != 0)
+            {
+                int32_t part = (std::abs(delta) < SIM_SUBPIXELS) ? delta : dir * SIM_SUBPIXELS;
+                int32_t next = pos + part;
+                if (horizontal ? blocked(next, y) : blocked(x, next))
+                {
+                    /* Close the remaining gap a subpixel at a time */
+                    while (!(horizontal ? blocked(pos + dir, y) : blocked(x, pos + dir))) pos += dir;
+                    return false;
+                }
+                pos = next;
+                delta -= part;
+            }
+            return true;
+        }
+        
+        void step(uint8_t buttons, uint8_t previous)
+        {
+            bool grounded = blocked(x, y + 1);
+            if (grounded) air = SIM_BALLOON_AIR;
+            
+            vx = ((buttons & BUTTON_RIGHT) ? SIM_WALK : 0) - ((buttons & BUTTON_LEFT) ? SIM_WALK : 0);
+            
+            Rect kid = box();
+            for (const Fan & fan : fans)
+            {
+                if (!kid.overlaps(fan.area)) continue;
+                if (fan.dir == 0) vy = std::max(vy - SIM_FAN_LIFT, SIM_FAN_RISE);
+                else              vx += fan.dir * SIM_FAN_PUSH;
+            }
+            
+            if (grounded && (buttons & BUTTON_A) && !(previous & BUTTON_A))
+            {
+                vy = SIM_JUMP;
+            }
+            vy = std::min(vy + SIM_GRAVITY, SIM_MAX_FALL);
+            if (!grounded && (buttons & BUTTON_A) && vy > SIM_FLOAT_FALL && air > 0)
+            {
+                vy = SIM_FLOAT_FALL;
+                air--;
+            }
+            
+            if (!move(x, vx, true)) vx = 0;
+            if (!move(y, vy, false)) vy = 0;
+        }
+        
+        /** Walkers pace back and forth, turning at walls and ledges */
+        void stepWalker(Walker & walker) const
+        {
+            int32_t ahead = pixel(walker.x) + (walker.dir > 0 ? 8 : -1);
+            int32_t feet = pixel(walker.y) + 8;
+            if (gridGetSolid(cell(ahead), cell(feet - 1)) || !gridGetSolid(cell(ahead), cell(feet)))
+            {
+                walker.dir = -walker.dir;
+            }
+            walker.x += walker.dir * SIM_WALKER_SPEED;
+        }
+};
+
+/** A recorded run through a level */
+struct Replay
+{
+    std::string level;
+    std::vector<uint8_t> input;     // ReplayButtons for each frame
+};
+
+/** Reads a replay file. The first line is "level <name>", and each line
+ * after that is a number of frames and the buttons held for them: any of
+ * L, R and A, or - for none. Lines starting with # are ignored. */
+bool read_replay(const std::string & file, Replay & replay, std::string & error)
+{
+    std::ifstream in(file);
+    if (!in)
+    {
+        error = "could not be read";
+        return false;
+    }
+    
+    std::string line;
+    while (std::getline(in, line))
+    {
+        char word[64];
+        char buttons[8];
+        long frames;
+        if (line.empty() || line[0] == '#') continue;
+        
+        if (sscanf(line.c_str(), "level %63s", word) == 1)
+        {
+            replay.level = word;
+        }
+        else if (sscanf(line.c_str(), "%ld %7s", &frames, buttons) == 2)
+        {
+            if (frames < 0 || frames > SIM_MAX_FRAMES - (long)replay.input.size())
+            {
+                error = "frame count out of range in \"" + line + "\"";
+                return false;
+            }
+            
+            uint8_t mask = 0;
+            for (const char * c = buttons; *c; c++)
+            {
+                if (*c == 'L') mask |= BUTTON_LEFT;
+                else if (*c == 'R') mask |= BUTTON_RIGHT;
+                else if (*c == 'A') mask |= BUTTON_A;
+                else if (*c != '-')
+                {
+                    error = "unknown button in \"" + line + "\"";
+                    return false;
+                }
+            }
+            replay.input.insert(replay.input.end(), frames, mask);
+        }
+        else
+        {
+            error = "cannot read \"" + line + "\"";
+            return false;
+        }
+    }
+    
+    if (replay.level.empty())
+    {
+        error = "no level given";
+        return false;
+    }
+    return true;
+}
+
+/** Runs replay files in parallel and prints how each one ends, in the
+ * order given. How a replay ends is only reported, since the simulation
+ * is an approximation. Returns true if every replay could be run. */
+bool simulate_replays(const std::vector<std::string> & files)
+{
+    static const char * const endings[] = {
+        "completed", "hit spikes", "hit a walker", "fell out of the level", "ran out of input"
+    };
+    std::vector<std::string> reports(files.size());
+    std::vector<bool> ran(files.size(), false);
+    
+    parallel_for(files.size(), [&](size_t i)
+    {
+        Replay replay;
+        std::string error;
+        if (!read_replay(files[i], replay, error))
+        {
+            reports[i] = files[i] + ": " + error;
+            return;
+        }
+        
+        const LevelInfo * level = find_level(replay.level);
+        if (!level)
+        {
+            reports[i] = files[i] + ": no level named " + replay.level;
+            return;
+        }
+        if (const char * invalid = validate_level(level->data, level->length))
+        {
+            reports[i] = files[i] + ": invalid level, " + invalid;
+            return;
+        }
+        
+        SimResult result = Simulator(level->data, level->length).run(replay.input);
+        char buf[160];
+        snprintf(buf, sizeof(buf), ": %s %s after %zu frames at %zd,%zd, %zu coins%s",
+            level->name, endings[result.outcome], result.frames, result.x, result.y,
+            result.coins, result.key ? ", key" : "");
+        reports[i] = files[i] + buf;
+        ran[i] = true;
+    });
+    
+    for (const std::string & report : reports)
+    {
+        std::cout << report << std::endl;
+    }
+    return std::find(ran.begin(), ran.end(), false) == ran.end();
+}
+
+/* The Arduboy screen, which is all of the level the player sees at once */
+static const ssize_t VIEW_WIDTH = 128;
+static const ssize_t VIEW_HEIGHT = 64;
+static const long VIEW_MAX_FRAMES = 1 << 20;    // about 5 hours at 60 fps
+
+enum VideoFormat
+{
+    VIDEO_Y4M,
+    VIDEO_PBM
+};
+
+/** One frame of viewport video: the top-left corner of the view, and
+ * where the kid is drawn when following a replay */
+struct ViewFrame
+{
+    ssize_t x;
+    ssize_t y;
+    Rect kid;           // empty when the kid stays in the map image
+};
+
+static ssize_t clamp_view(ssize_t pos, ssize_t view, ssize_t size)
+{
+    return std::max<ssize_t>(0, std::min(pos, size - view));
+}
+
+/** Reads a camera path. The first line is "level <name>", and each line
+ * after that is "<frames> <x> <y>": the view pans in a straight line from
+ * where it is to the pixel (x, y) over that many frames, or jumps there
+ * when frames is 0. The view starts at the top-left of the level. Lines
+ * starting with # are ignored. */
+bool read_camera_path(const std::string & file, std::string & level, std::vector<ViewFrame> & frames, std::string & error)
+{
+    std::ifstream in(file);
+    if (!in)
+    {
+        error = "could not be read";
+        return false;
+    }
+    
+    ssize_t x = 0, y = 0;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        char word[64];
+        long count;
+        long tox, toy;
+        if (line.empty() || line[0] == '#') continue;
+        
+        if (sscanf(line.c_str(), "level %63s", word) == 1)
+        {
+            level = word;
+        }
+        else if (sscanf(line.c_str(), "%ld %ld %ld", &count, &tox, &toy) == 3)
+        {
+            if (count < 0 || count > VIEW_MAX_FRAMES - (long)frames.size())
+            {
+                error = "frame count out of range in \"" + line + "\"";
+                return false;
+            }
+            
+            tox = clamp_view(tox, VIEW_WIDTH, LEVEL_WIDTH);
+            toy = clamp_view(toy, VIEW_HEIGHT, LEVEL_HEIGHT);
+            for (long i = 1; i <= count; i++)
+            {
+                frames.push_back(ViewFrame{x + (tox - x) * i / count, y + (toy - y) * i / count, Rect{0, 0, 0, 0}});
+            }
+            x = tox;
+            y = toy;
+        }
+        else
+        {
+            error = "cannot read \"" + line + "\"";
+            return false;
+        }
+    }
+    
+    if (level.empty())
+    {
+        error = "no level given";
+        return false;
+    }
+    return true;
+}
+
+/** True if the first line after the comments and the level holds
+ * buttons, as in a replay, rather than a camera move of three numbers */
+bool is_replay(const std::string & file)
+{
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        long count, x, y;
+        if (line.empty() || line[0] == '#' || line.compare(0, 6, "level ") == 0) continue;
+        return sscanf(line.c_str(), "%ld %ld %ld", &count, &x, &y) != 3;
+    }
+    return false;
+}
+
+/** Writes what the Arduboy screen shows along a camera path or a replay to
+ * stdout, as a Y4M (monochrome, 60 fps) or raw PBM stream that can be
+ * piped into an encoder. A replay file is recognised by its button lines;
+ * the view then follows the kid as it moves, clamped to the level edges.
+ * 
+ * The level is drawn once, and each frame is cropped from that image, with
+ * the kid copied on top when following a replay. */
+bool write_viewport(const std::string & file, VideoFormat format)
+{
+    std::string level_name;
+    std::vector<ViewFrame> frames;
+    std::string error;
+    Replay replay;
+    bool follow = is_replay(file);
+    if (follow ? !read_replay(file, replay, error) : !read_camera_path(file, level_name, frames, error))
+    {
+        std::cerr << file << ": " << error << std::endl;
+        return false;
+    }
+    if (follow && (long)replay.input.size() > VIEW_MAX_FRAMES)
+    {
+        std::cerr << file << ": replay is too long to view" << std::endl;
+        return false;
+    }
+    if (follow)
+    {
+        level_name = replay.level;
+    }
+    
+    const LevelInfo * level = find_level(level_name);
+    if (!level)
+    {
+        std::cerr << file << ": no level named " << level_name << std::endl;
+        return false;
+    }
+    if (const char * invalid = validate_level(level->data, level->length))
+    {
+        std::cerr << file << ": invalid level, " << invalid << std::endl;
+        return false;
+    }
+    
+    DisplayList list = make_display_list(level->data, level->length);
+    if (follow)
+    {
+        /* The kid moves, so it is drawn per frame rather than into the map */
+        std::vector<Blit> & blits = list.frames[0];
+        blits.erase(std::remove_if(blits.begin(), blits.end(),
+            [](const Blit & blit) { return blit.sprite == SPRITE_KID; }), blits.end());
+        
+        std::vector<Rect> trail;
+        Simulator(level->data, level->length).run(replay.input, &trail);
+        for (const Rect & kid : trail)
+        {
+            frames.push_back(ViewFrame{
+                clamp_view(kid.x + kid.width / 2 - VIEW_WIDTH / 2, VIEW_WIDTH, LEVEL_WIDTH),
+                clamp_view(kid.y + kid.height / 2 - VIEW_HEIGHT / 2, VIEW_HEIGHT, LEVEL_HEIGHT),
+                kid});
+        }
+    }
+    const Bitmap map = render_bitmap(list);
+    
+    if (format == VIDEO_Y4M)
+    {
+        std::cout << "YUV4MPEG2 W" << VIEW_WIDTH << " H" << VIEW_HEIGHT << " F60:1 Ip A1:1 Cmono\n";
+    }
+    
+    Bitmap view(VIEW_WIDTH, VIEW_HEIGHT);
+    for (const ViewFrame & frame : frames)
+    {
+        for (ssize_t row = 0; row < VIEW_HEIGHT; row++)
+        {
+            memcpy(&view.pixels[row * VIEW_WIDTH],
+                &map.pixels[(frame.y + row) * LEVEL_WIDTH + frame.x], VIEW_WIDTH);
+        }
+        if (frame.kid.width)
+        {
+            /* The kid's body sits 2 pixels into its sprite */
+            view.blit(sprite_bitmaps[SPRITE_KID][0], frame.kid.x - 2 - frame.x, frame.kid.y - frame.y);
+        }
+        
+        if (format == VIDEO_Y4M)
+        {
+            std::cout << "FRAME\n";
+            std::cout.write((const char *)view.pixels.data(), view.pixels.size());
+            continue;
+        }
+        
+        std::vector<uint8_t> pbm = encode_pbm(view);
+        std::cout.write((const char *)pbm.data(), pbm.size());
+    }
+    
+    std::cout.flush();
+    return (bool)std::cout;
+}
+
+/** Hashes a raw pixel buffer for the golden output check. This is FNV-1a
+ * applied to 64-bit words rather than bytes, so it keeps up with the
+ * renderer. */
+uint64_t pixel_hash(const std::vector<uint8_t> & pixels, uint64_t hash=14695981039346656037ULL)
+{
+    size_t i = 0;
+    for (; i + 8 <= pixels.size(); i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, &pixels[i], sizeof(word));
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    for (; i < pixels.size(); i++)
+    {
+        hash = (hash ^ pixels[i]) * 1099511628211ULL;
+    }
+    
+    return hash;
+}
+
+/** Hashes every frame of a sprite, including transparency */
+uint64_t pixel_hash(const std::vector<Bitmap> & frames)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const Bitmap & frame : frames)
+    {
+        hash = pixel_hash(frame.pixels, hash);
+        if (frame.alpha.empty()) continue;
+        
+        std::vector<uint8_t> opaque(frame.alpha.size());
+        for (size_t i = 0; i < opaque.size(); i++)
+        {
+            opaque[i] = frame.alpha[i] >= 0x80;
+        }
+        hash = pixel_hash(opaque, hash);
+    }
+    
+    return hash;
+}
+
+struct GoldenEntry
+{
+    std::string name;
+    uint64_t hash;
+};
+
+/** Draws every frame of the *_plus_mask assets over the first level, so
+ * the check covers compositing through their masks */
+Bitmap composite_plus_mask()
+{
+    const LevelInfo & level = level_registry[0];
+    Bitmap canvas = render_bitmap(make_display_list(level.data, level.length));
+    ssize_t x = 0, y = 0;
+    for (const AssetInfo & asset : assets)
+    {
+        if (asset.layout != ASSET_PLUS_MASK) continue;
+        
+        for (const Bitmap & frame : decode_asset(asset))
+        {
+            if (x + (ssize_t)frame.width > (ssize_t)canvas.width)
+            {
+                x = 0;
+                y += LEVEL_CELLSIZE * 2;
+            }
+            canvas.blit(frame, x, y);
+            x += frame.width + LEVEL_CELLSIZE / 2;
+        }
+    }
+    
+    return canvas;
+}
+
+/** Renders every level, decodes every asset and composites the masked
+ * ones, hashing the raw pixels */
+std::vector<GoldenEntry> golden_hashes()
+{
+    const size_t num_assets = sizeof(assets) / sizeof(assets[0]);
+    std::vector<GoldenEntry> result(num_levels + num_assets + 1);
+    
+    parallel_for(result.size(), [&](size_t i)
+    {
+        if (i == num_levels + num_assets)
+        {
+            result[i].name = "plus_mask_composite";
+            result[i].hash = pixel_hash(composite_plus_mask().pixels);
+        }
+        else if (i < num_levels)
+        {
+            const LevelInfo & level = level_registry[i];
+            result[i].name = level.name;
+            result[i].hash = pixel_hash(render_bitmap(make_display_list(level.data, level.length)).pixels);
+        }
+        else
+        {
+            const AssetInfo & asset = assets[i - num_levels];
+            result[i].name = asset.name;
+            result[i].hash = pixel_hash(decode_asset(asset));
+        }
+    });
+    
+    return result;
+}
+
+#ifndef NO_MAGICK
+/** Writes a map showing where a level differs from a reference image.
+ * Matching pixels are faded, differing pixels are red. */
+void write_diff(const std::string & name, const Image & rendered, const Image & reference)
+{
+    std::vector<uint8_t> ours = gray_pixels(rendered);
+    std::vector<uint8_t> theirs = gray_pixels(reference);
+    if (ours.size() != theirs.size())
+    {
+        std::cerr << name << ": reference image has a different size" << std::endl;
+        return;
+    }
+    
+    std::vector<uint8_t> diff(ours.size() * 3);
+    for (size_t i = 0; i < ours.size(); i++)
+    {
+        uint8_t faded = 0xC0 + ours[i] / 4;
+        bool same = ours[i] == theirs[i];
+        diff[i * 3] = same ? faded : 0xFF;
+        diff[i * 3 + 1] = same ? faded : 0x00;
+        diff[i * 3 + 2] = same ? faded : 0x00;
+    }
+    
+    Image img(Blob(diff.data(), diff.size()), Geometry(rendered.columns(), rendered.rows()), 8, "RGB");
+    img.write(name + ".diff.png");
+}
+#endif
+
+/** Compares rendered output against a manifest of pixel hashes, printing
+ * each mismatch. If refdir is given, a diff image is written for each
+ * mismatched level against refdir/<level>.png. Every asset must also
+ * survive being encoded again and decoded. With update set, the manifest
+ * is rewritten instead.
+ * 
+ * Returns true if everything matched. */
+bool check_golden(const std::string & manifest, const std::string & refdir, bool update)
+{
+#ifdef NO_MAGICK
+    (void)refdir;       // diffs need Magick to read the reference images
+#endif
+    std::vector<GoldenEntry> hashes = golden_hashes();
+    
+    if (update)
+    {
+        std::ofstream out(manifest);
+        out << "# Pixel hashes of every level and asset, checked by mbmapper --check" << std::endl;
+        for (const GoldenEntry & entry : hashes)
+        {
+            char buf[24];
+            snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)entry.hash);
+            out << entry.name << " " << buf << std::endl;
+        }
+        return out.good();
+    }
+    
+    std::ifstream in(manifest);
+    if (!in)
+    {
+        std::cerr << "Could not read " << manifest << std::endl;
+        return false;
+    }
+    
+    std::unordered_map<std::string, uint64_t> expected;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        char name[256];
+        unsigned long long hash;
+        if (line[0] != '#' && sscanf(line.c_str(), "%255s %llx", name, &hash) == 2)
+        {
+            expected[name] = hash;
+        }
+    }
+    
+    size_t failures = 0;
+    for (const GoldenEntry & entry : hashes)
+    {
+        auto found = expected.find(entry.name);
+        if (found == expected.end())
+        {
+            std::cout << entry.name << ": not in " << manifest << std::endl;
+            failures++;
+            continue;
+        }
+        uint64_t hash = found->second;
+        expected.erase(found);
+        if (hash == entry.hash) continue;
+        
+        std::cout << entry.name << ": pixels changed" << std::endl;
+        failures++;
+        
+#ifndef NO_MAGICK
+        for (size_t i = 0; i < num_levels && !refdir.empty(); i++)
+        {
+            const LevelInfo & level = level_registry[i];
+            if (entry.name != level.name) continue;
+            
+            write_diff(entry.name, generate_map(level.data, level.length),
+                Image(refdir + "/" + entry.name + ".png"));
+        }
+#endif
+    }
+    for (const auto & missing : expected)
+    {
+        std::cout << missing.first << ": no longer rendered" << std::endl;
+        failures++;
+    }
+    for (const AssetInfo & asset : assets)
+    {
+        if (asset_round_trips(asset)) continue;
+        
+        std::cout << asset.name << ": changed by encoding it again" << std::endl;
+        failures++;
+    }
+
+    std::cout << hashes.size() - std::min(failures, hashes.size()) << " of "
+              << hashes.size() << " outputs match" << std::endl;
+    return failures == 0;
+}
+
+/** Lists the files in an archive, sorted by name, as "name size hash"
+ * lines after a header naming the shard. The manifests of all shards are
+ * combined with merge_manifests. */
+bool write_manifest(const std::string & file, const std::vector<FileWriter::ArchiveEntry> & archived,
+                    size_t shard, size_t shards)
+{
+    std::vector<FileWriter::ArchiveEntry> entries = archived;
+    std::sort(entries.begin(), entries.end(),
+        [](const FileWriter::ArchiveEntry & a, const FileWriter::ArchiveEntry & b) { return a.name < b.name; });
+    
+    std::ofstream out(file);
+    out << "# shard " << shard + 1 << "/" << shards << std::endl;
+    for (const FileWriter::ArchiveEntry & entry : entries)
+    {
+        char buf[24];
+        snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)entry.hash);
+        out << entry.name << " " << entry.size << " " << buf << std::endl;
+    }
+    if (!out) std::cerr << "Could not write " << file << std::endl;
+    return out.good();
+}
+
+/** Combines the manifests of every shard of a run into one. Fails if a
+ * shard is missing or repeated, or if two shards wrote different files
+ * under the same name; files both wrote identically are listed once. */
+bool merge_manifests(const std::string & file, const std::vector<std::string> & manifests)
+{
+    std::map<std::string, std::string> files;
+    std::vector<bool> seen;
+    size_t shards = 0;
+    bool ok = true;
+    
+    for (const std::string & manifest : manifests)
+    {
+        std::ifstream in(manifest);
+        std::string line;
+        size_t shard, count;
+        if (!std::getline(in, line) || sscanf(line.c_str(), "# shard %zu/%zu", &shard, &count) != 2 ||
+            shard < 1 || shard > count || (shards && count != shards))
+        {
+            std::cerr << manifest << ": not a manifest of this run" << std::endl;
+            return false;
+        }
+        shards = count;
+        seen.resize(shards, false);
+        if (seen[shard - 1])
+        {
+            std::cerr << manifest << ": shard " << shard << " given twice" << std::endl;
+            ok = false;
+        }
+        seen[shard - 1] = true;
+        
+        while (std::getline(in, line))
+        {
+            std::string name = line.substr(0, line.find(' '));
+            auto found = files.find(name);
+            if (found != files.end() && found->second != line)
+            {
+                std::cerr << name << ": differs between shards" << std::endl;
+                ok = false;
+            }
+            files[name] = line;
+        }
+    }
+    
+    for (size_t i = 0; i < shards; i++)
+    {
+        if (!seen[i])
+        {
+            std::cerr << "Shard " << i + 1 << "/" << shards << " is missing" << std::endl;
+            ok = false;
+        }
+    }
+    if (!ok) return false;
+    
+    std::ofstream out(file);
+    out << "# " << shards << " shards" << std::endl;
+    for (const auto & entry : files)
+    {
+        out << entry.second << std::endl;
+    }
+    if (!out) std::cerr << "Could not write " << file << std::endl;
+    return out.good();
+}
+
+#ifndef NO_MAGICK
+/** Hashes a rectangle of thresholded pixels (FNV-1a over packed rows) */
+uint64_t fingerprint(const uint8_t * pixels, size_t stride,
+        size_t x, size_t y, size_t width, size_t height)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t row = y; row < y + height; row++)
+    {
+        const uint8_t * line = pixels + row * stride + x;
+        uint32_t bits = 0;
+        for (size_t col = 0; col < width; col++)
+        {
+            bits = (bits << 1) | line[col];
+        }
+        hash = (hash ^ bits) * 1099511628211ULL;
+    }
+    
+    return hash;
+}
+
+/** Converts rendered map images back into the level format.
+ * 
+ * Every sprite that generate_map can draw is fingerprinted once, so
+ * recognising a cell is a handful of hash lookups rather than pixel
+ * comparisons against every frame. */
+class MapImporter
+{
+    public:
+        MapImporter()
+        {
+            addFrames(tileprints, tiles, 0);
+            addFrames(objprints[0], doorimg, LFINISH);
+            addFrames(objprints[1], kid, LSTART);
+            addFrames(objprints[2], elemimg, LCOIN);
+            addFrames(objprints[3], walker, LWALKER);
+            addFrames(spikeprints, spikes, LSPIKES);
+            
+            /* Elements frame 4 is the key rather than a coin, and fans
+             * are identified by direction rather than animation frame */
+            objprints[2][fingerprint(elemimg[4])] = Match{LKEY, 0};
+            for (size_t i = 0; i < fanimg.size(); i++)
+            {
+                objprints[0][fingerprint(fanimg[i])] = Match{LFAN, (uint8_t)(i / 3)};
+            }
+            
+            for (const Image & tile : tiles)
+            {
+                std::vector<uint8_t> pixels = mono_pixels(tile);
+                std::vector<uint16_t> rows(LEVEL_CELLSIZE);
+                for (size_t y = 0; y < LEVEL_CELLSIZE; y++)
+                {
+                    for (size_t x = 0; x < LEVEL_CELLSIZE; x++)
+                    {
+                        rows[y] = (rows[y] << 1) | pixels[y * LEVEL_CELLSIZE + x];
+                    }
+                }
+                tilerows.push_back(rows);
+            }
+        }
+        
+        /** Converts an image of a map into level bytes, including the
+         * terminating 0xFF. Scaled maps are sampled back down first. */
+        std::vector<uint8_t> convert(const Image & img)
+        {
+            Image sized = img;
+            if (sized.columns() != LEVEL_WIDTH || sized.rows() != LEVEL_HEIGHT)
+            {
+                Geometry size(LEVEL_WIDTH, LEVEL_HEIGHT);
+                size.aspect(true);
+                sized.sample(size);
+            }
+            pixels = mono_pixels(sized);
+            
+            uint8_t solid[LEVEL_WIDTH_CELLS][LEVEL_HEIGHT_CELLS] = {{0}};
+            int8_t spikedir[LEVEL_WIDTH_CELLS][LEVEL_HEIGHT_CELLS];
+            std::vector<uint8_t> objects;
+            std::vector<uint8_t> start;
+            
+            for (size_t y = 0; y < LEVEL_HEIGHT_CELLS; y++)
+            {
+                for (size_t x = 0; x < LEVEL_WIDTH_CELLS; x++)
+                {
+                    /* Pixels covered by objects are ignored when deciding
+                     * whether the cell underneath is solid */
+                    uint16_t covered[LEVEL_CELLSIZE] = {0};
+                    
+                    Match obj;
+                    spikedir[x][y] = findSpikes(x, y, covered);
+                    if (spikedir[x][y] < 0 && findObject(x, y, obj, covered))
+                    {
+                        std::vector<uint8_t> & out = (obj.id == LSTART) ? start : objects;
+                        out.push_back(obj.id | y);
+                        out.push_back(x);
+                        
+                        /* Fans are solid blocks and hide the whole cell */
+                        if (obj.id == LFAN)
+                        {
+                            out.push_back(obj.frame);
+                            solid[x][y] = 1;
+                            continue;
+                        }
+                    }
+                    
+                    solid[x][y] = classifyTile(x, y, covered) < 16;
+                }
+            }
+            
+            /* Fill in fan strengths now that solid cells are known. These
+             * cannot be seen in the image, so blow to the next wall. */
+            for (size_t i = 0; i < objects.size(); )
+            {
+                uint8_t id = objects[i] & 0xE0;
+                if (id != LFAN)
+                {
+                    i += 2;
+                    continue;
+                }
+                
+                int x = objects[i+1], y = objects[i] & 0x1F;
+                uint8_t dir = objects[i+2];
+                int dx = (dir == 1) ? 1 : (dir == 2) ? -1 : 0;
+                int dy = (dir == 0) ? -1 : 0;
+                uint8_t reach = 0;
+                for (int cx = x + dx, cy = y + dy;
+                     cx >= 0 && cx < LEVEL_WIDTH_CELLS && cy >= 0 && !solid[cx][cy] && reach < 63;
+                     cx += dx, cy += dy)
+                {
+                    reach++;
+                }
+                objects[i+2] = std::max<uint8_t>(reach, 1) | (dir == 1 ? 128 : dir == 2 ? 192 : 0);
+                i += 3;
+            }
+            
+            /* Merge spike cells into runs of up to 8 along the wall */
+            for (size_t y = 0; y < LEVEL_HEIGHT_CELLS; y++)
+            {
+                for (size_t x = 0; x < LEVEL_WIDTH_CELLS; x++)
+                {
+                    int8_t dir = spikedir[x][y];
+                    if (dir < 0) continue;
+                    
+                    bool horiz = (dir == 1 || dir == 3);
+                    size_t len = 0;
+                    while (len < 8)
+                    {
+                        size_t cx = horiz ? x + len : x;
+                        size_t cy = horiz ? y : y + len;
+                        if (cx >= LEVEL_WIDTH_CELLS || cy >= LEVEL_HEIGHT_CELLS ||
+                            spikedir[cx][cy] != dir)
+                        {
+                            break;
+                        }
+                        spikedir[cx][cy] = -1;
+                        len++;
+                    }
+                    
+                    objects.push_back(LSPIKES | y);
+                    objects.push_back(((len - 1) << 5) | x);
+                }
+            }
+            
+            std::vector<uint8_t> level(LEVEL_CELL_BYTES, 0);
+            for (size_t y = 0; y < LEVEL_HEIGHT_CELLS; y++)
+            {
+                for (size_t x = 0; x < LEVEL_WIDTH_CELLS; x++)
+                {
+                    level[x / 8 + y * LEVEL_WIDTH_CELLS / 8] |= solid[x][y] << (x % 8);
+                }
+            }
+            level.insert(level.end(), start.begin(), start.end());
+            level.insert(level.end(), objects.begin(), objects.end());
+            level.push_back(0xFF);
+            
+            return level;
+        }
+        
+    protected:
+        struct Match
+        {
+            uint8_t id;
+            uint8_t frame;
+        };
+        typedef std::unordered_map<uint64_t, Match> PrintTable;
+        
+        /* Fingerprints of 16x16 cells, then objects grouped by their size
+         * and position in the cell: door and fan, kid, coin and key,
+         * and walker. */
+        PrintTable tileprints;
+        PrintTable objprints[4];
+        PrintTable spikeprints;
+        std::vector<std::vector<uint16_t>> tilerows;
+        std::vector<uint8_t> pixels;
+        
+        static uint64_t fingerprint(const Image & img)
+        {
+            std::vector<uint8_t> mono = mono_pixels(img);
+            return ::fingerprint(mono.data(), img.columns(), 0, 0, img.columns(), img.rows());
+        }
+        
+        void addFrames(PrintTable & table, const std::vector<Image> & frames, uint8_t id)
+        {
+            for (size_t i = 0; i < frames.size(); i++)
+            {
+                table.emplace(fingerprint(frames[i]), Match{id, (uint8_t)i});
+            }
+        }
+        
+        uint64_t cellprint(size_t x, size_t y, size_t xoff, size_t yoff, size_t width, size_t height) const
+        {
+            return ::fingerprint(pixels.data(), LEVEL_WIDTH,
+                x * LEVEL_CELLSIZE + xoff, y * LEVEL_CELLSIZE + yoff, width, height);
+        }
+        
+        /** Marks a rectangle of a cell as covered */
+        static void cover(uint16_t * covered, size_t x, size_t y, size_t width, size_t height)
+        {
+            uint16_t bits = ((1U << width) - 1) << (LEVEL_CELLSIZE - x - width);
+            for (size_t row = y; row < y + height; row++)
+            {
+                covered[row] |= bits;
+            }
+        }
+        
+        bool findObject(size_t x, size_t y, Match & obj, uint16_t * covered) const
+        {
+            static const size_t layout[4][4] = {
+                {0, 0, 16, 16}, {2, 0, 12, 16}, {3, 0, 10, 16}, {4, 8, 8, 8}};
+            
+            for (size_t i = 0; i < 4; i++)
+            {
+                const size_t * l = layout[i];
+                auto found = objprints[i].find(cellprint(x, y, l[0], l[1], l[2], l[3]));
+                if (found != objprints[i].end())
+                {
+                    obj = found->second;
+                    cover(covered, l[0], l[1], l[2], l[3]);
+                    return true;
+                }
+            }
+            
+            return false;
+        }
+        
+        /** Returns the spike direction if the cell holds two matching
+         * spike pieces, or -1 if not. Offsets follow drawSpikes. */
+        int8_t findSpikes(size_t x, size_t y, uint16_t * covered) const
+        {
+            static const size_t pieces[4][4] = {
+                {0, 0, 0, 8}, {0, 8, 8, 8}, {8, 0, 8, 8}, {0, 0, 8, 0}};
+            
+            for (size_t dir = 0; dir < 4; dir++)
+            {
+                const size_t * p = pieces[dir];
+                auto a = spikeprints.find(cellprint(x, y, p[0], p[1], 8, 8));
+                auto b = spikeprints.find(cellprint(x, y, p[2], p[3], 8, 8));
+                if (a != spikeprints.end() && b != spikeprints.end() &&
+                    a->second.frame == dir && b->second.frame == dir)
+                {
+                    cover(covered, p[0], p[1], 8, 8);
+                    cover(covered, p[2], p[3], 8, 8);
+                    return dir;
+                }
+            }
+            
+            return -1;
+        }
+        
+        /** Finds the tile frame for a cell, ignoring covered pixels.
+         * Cells with objects or hand-drawn edits fall back to the frame
+         * with the fewest differing pixels. */
+        size_t classifyTile(size_t x, size_t y, const uint16_t * covered) const
+        {
+            uint16_t anycovered = 0;
+            for (size_t row = 0; row < LEVEL_CELLSIZE; row++)
+            {
+                anycovered |= covered[row];
+            }
+            
+            if (!anycovered)
+            {
+                auto found = tileprints.find(cellprint(x, y, 0, 0, LEVEL_CELLSIZE, LEVEL_CELLSIZE));
+                if (found != tileprints.end())
+                {
+                    return found->second.frame;
+                }
+            }
+            
+            uint16_t rows[LEVEL_CELLSIZE];
+            for (size_t row = 0; row < LEVEL_CELLSIZE; row++)
+            {
+                const uint8_t * line = &pixels[(y * LEVEL_CELLSIZE + row) * LEVEL_WIDTH + x * LEVEL_CELLSIZE];
+                rows[row] = 0;
+                for (size_t col = 0; col < LEVEL_CELLSIZE; col++)
+                {
+                    rows[row] = (rows[row] << 1) | line[col];
+                }
+            }
+            
+            /* Fully covered cells default to empty */
+            size_t best = 16;
+            size_t bestdist = SIZE_MAX;
+            for (size_t t = 0; t < tilerows.size(); t++)
+            {
+                size_t dist = 0;
+                for (size_t row = 0; row < LEVEL_CELLSIZE; row++)
+                {
+                    dist += __builtin_popcount((rows[row] ^ tilerows[t][row]) & ~covered[row] & 0xFFFF);
+                }
+                if (dist < bestdist || (dist == bestdist && t == 16))
+                {
+                    best = t;
+                    bestdist = dist;
+                }
+            }
+            
+            return best;
+        }
+};
+#endif
+
+/** Prints level bytes as a C array in the same layout as bitmaps.h */
+void print_level(std::ostream & out, const std::string & name, const std::vector<uint8_t> & level)
+{
+    char buf[16];
+    out << "const uint8_t " << name << " [] PROGMEM = {" << std::endl;
+    out << "// Tiles" << std::endl;
+    for (size_t i = 0; i < LEVEL_CELL_BYTES; i++)
+    {
+        snprintf(buf, sizeof(buf), "0x%02X,", level[i]);
+        out << buf << ((i % 9 == 8) ? "\n" : " ");
+    }
+    
+    out << "// Objects" << std::endl;
+    for (size_t i = LEVEL_CELL_BYTES; i < level.size() - 1; i++)
+    {
+        out << "0b";
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            out << ((level[i] >> bit) & 1);
+        }
+        out << ",";
+    }
+    if (level.size() - 1 > LEVEL_CELL_BYTES) out << std::endl;
+    
+    out << "// EoL" << std::endl << "0xFF" << std::endl << "};" << std::endl;
+}
+
+/* Errors thrown while rendering or encoding, such as a failed PNG
+ * compression, are reported and end the run with status 1. Levels on
+ * other threads are still finished first, by parallel_for. */
+int main(int argc,char **argv)
+try
+{ 
+    std::vector<std::string> imports;
+    std::vector<std::string> encodes;
+    std::vector<std::string> validates;
+    std::vector<std::string> replays;
+    std::vector<std::string> merges;
+    size_t shard = 0, shards = 1;
+    std::string archive;
+    bool encode_masked = false;
+    bool export_all = false;
+    bool list = false;
+    bool poster = false;
+    bool heatmap = false;
+    bool duplicates = false;
+    std::string similar;
+    bool routes = false;
+    std::string packfile;
+    std::string frompack;
+    std::string viewport;
+    VideoFormat video_format = VIDEO_Y4M;
+    std::string manifest;
+    std::string refdir;
+    bool update_manifest = false;
+    std::vector<std::string> selectors;
+    for (int arg = 1; arg < argc; arg++)
+    {
+        std::string opt = argv[arg];
+        if (opt == "--animate")
+        {
+            map_format = MAP_GIF;
+        }
+        else if (opt == "--svg")
+        {
+            map_format = MAP_SVG;
+        }
+        else if (opt == "--qoi")
+        {
+            map_format = MAP_QOI;
+        }
+        else if (opt == "--pgm")
+        {
+            map_format = MAP_PGM;
+        }
+        else if (opt == "--tty")
+        {
+            map_format = MAP_TTY;
+        }
+        else if (opt == "--sixel")
+        {
+            map_format = MAP_SIXEL;
+        }
+        else if (opt == "--export-assets")
+        {
+            export_all = true;
+        }
+        else if (opt == "--list")
+        {
+            list = true;
+        }
+        else if (opt == "--poster")
+        {
+            poster = true;
+        }
+        else if (opt == "--heatmap")
+        {
+            heatmap = true;
+        }
+        else if (opt == "--similar" && arg + 1 < argc)
+        {
+            similar = argv[++arg];
+        }
+        else if (opt == "--duplicates")
+        {
+            duplicates = true;
+        }
+        else if (opt == "--route")
+        {
+            routes = true;
+        }
+        else if (opt == "--pbm")
+        {
+            video_format = VIDEO_PBM;
+            map_format = MAP_PBM;
+        }
+        else if (opt[0] != '-')
+        {
+            selectors.push_back(opt);
+        }
+        else if (opt == "--pack" && arg + 1 < argc)
+        {
+            packfile = argv[++arg];
+        }
+        else if (opt == "--from" && arg + 1 < argc)
+        {
+            frompack = argv[++arg];
+        }
+        else if (opt == "--shard" && arg + 1 < argc)
+        {
+            if (sscanf(argv[++arg], "%zu/%zu", &shard, &shards) != 2 || shard < 1 || shard > shards)
+            {
+                std::cerr << "Shards are given as i/n, with i from 1 to n" << std::endl;
+                return 1;
+            }
+            shard--;
+        }
+        else if (opt == "--archive" && arg + 1 < argc)
+        {
+            archive = argv[++arg];
+        }
+        else if (opt == "--viewport" && arg + 1 < argc)
+        {
+            viewport = argv[++arg];
+        }
+        else if ((opt == "--check" || opt == "--update-check") && arg + 1 < argc)
+        {
+            manifest = argv[++arg];
+            update_manifest = (opt == "--update-check");
+        }
+        else if (opt == "--diff" && arg + 1 < argc)
+        {
+            refdir = argv[++arg];
+        }
+        else if (opt == "-j" && arg + 1 < argc)
+        {
+            jobs = std::max(1, atoi(argv[++arg]));
+        }
+        else if (opt == "--import" && arg + 1 < argc)
+        {
+            imports.assign(argv + arg + 1, argv + argc);
+            break;
+        }
+        else if (opt == "--merge" && arg + 2 < argc)
+        {
+            merges.assign(argv + arg + 1, argv + argc);
+            break;
+        }
+        else if (opt == "--simulate" && arg + 1 < argc)
+        {
+            replays.assign(argv + arg + 1, argv + argc);
+            break;
+        }
+        else if (opt == "--validate" && arg + 1 < argc)
+        {
+            validates.assign(argv + arg + 1, argv + argc);
+            break;
+        }
+        else if ((opt == "--encode" || opt == "--encode-masked") && arg + 1 < argc)
+        {
+            encodes.assign(argv + arg + 1, argv + argc);
+            encode_masked = (opt == "--encode-masked");
+            break;
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [-j threads] [--animate|--svg|--qoi|--pbm|--pgm] [--route] [level...]" << std::endl;
+            std::cerr << "       " << argv[0] << " --list [level...]" << std::endl;
+            std::cerr << "       " << argv[0] << " --pack file.pack [level...]" << std::endl;
+            std::cerr << "       " << argv[0] << " [-j threads] [--animate|--svg|--qoi|--pbm|--pgm|--route|--list] --from file.pack [level...]" << std::endl;
+            std::cerr << "       " << argv[0] << " --tty|--sixel [--from file.pack] [level...]" << std::endl;
+            std::cerr << "       " << argv[0] << " [-j threads] --poster [--qoi|--pbm|--pgm] [--from file.pack] [level...]" << std::endl;
+            std::cerr << "       " << argv[0] << " [-j threads] --heatmap [--from file.pack] [level...]" << std::endl;
+            std::cerr << "       " << argv[0] << " [-j threads] --similar level|--duplicates [--from file.pack] [level...]" << std::endl;
+            std::cerr << "       " << argv[0] << " --check|--update-check manifest [--diff refdir]" << std::endl;
+            std::cerr << "       " << argv[0] << " [-j threads] --export-assets" << std::endl;
+            std::cerr << "       " << argv[0] << " --import image..." << std::endl;
+            std::cerr << "       " << argv[0] << " --encode[-masked] image..." << std::endl;
+            std::cerr << "       " << argv[0] << " --validate level.bin..." << std::endl;
+            std::cerr << "       " << argv[0] << " [-j threads] --simulate replay..." << std::endl;
+            std::cerr << "       " << argv[0] << " --viewport camera|replay [--pbm] > video" << std::endl;
+            std::cerr << "       " << argv[0] << " --shard i/n [--archive out.tar] [--from file.pack] [level...]" << std::endl;
+            std::cerr << "       " << argv[0] << " --merge out.manifest shard.manifest..." << std::endl;
+            return 1;
+        }
+    }
+    
+#ifdef NO_MAGICK
+    if (map_format == MAP_GIF || !refdir.empty() || !imports.empty() || !encodes.empty())
+    {
+        std::cerr << argv[0] << " was built without GraphicsMagick, which is needed "
+                  << "to read images and write GIFs" << std::endl;
+        return 1;
+    }
+    (void)encode_masked;    // only read when encoding images
+#endif
+    
+    if (routes && !raster_format())
+    {
+        std::cerr << "Routes are only drawn on still image maps" << std::endl;
+        return 1;
+    }
+    
+    /* Posters show the game as it is played unless told otherwise */
+    if (poster && selectors.empty() && frompack.empty())
+    {
+        selectors.push_back("game");
+    }
+    if (heatmap && selectors.empty() && frompack.empty())
+    {
+        selectors.push_back("game");
+    }
+    
+    /* Levels come from a pack instead of bitmaps.h */
+    LevelPack pack;
+    if (!frompack.empty() && !pack.open(frompack))
+    {
+        return 1;
+    }
+    
+    std::vector<size_t> selected;
+    if (!(frompack.empty() ? select_levels(selectors, selected) : select_pack_levels(pack, selectors, selected)))
+    {
+        return 1;
+    }
+    
+    /* Keep only this process's share of the levels */
+    if (shards > 1)
+    {
+        std::vector<size_t> costs;
+        for (size_t i : selected)
+        {
+            size_t length;
+            if (!frompack.empty()) pack.level(i, length);
+            else                   length = level_registry[i].length;
+            costs.push_back(length);
+        }
+        selected = shard_levels(selected, costs, shard, shards);
+    }
+    
+    /* Add levels to a pack, then bring its index up to date */
+    if (!packfile.empty())
+    {
+        for (size_t i : selected)
+        {
+            bool added;
+            if (!frompack.empty())
+            {
+                size_t length;
+                const uint8_t * data = pack.level(i, length);
+                added = LevelPack::append(packfile, pack.name(i), data, length);
+            }
+            else
+            {
+                const LevelInfo & level = level_registry[i];
+                added = LevelPack::append(packfile, level.name, level.data, level.length);
+            }
+            if (!added) return 1;
+        }
+        
+        LevelPack out;
+        if (!out.open(packfile)) return 1;
+        std::cout << packfile << ": " << out.size() << " levels" << std::endl;
+        return 0;
+    }
+    
+    if (list && !frompack.empty())
+    {
+        for (size_t i : selected)
+        {
+            std::cout << pack.name(i) << "\t" << i + 1 << std::endl;
+        }
+        return 0;
+    }
+    else if (list)
+    {
+        for (size_t i : selected)
+        {
+            const LevelInfo & level = level_registry[i];
+            std::cout << level.name << "\t";
+            if (level.sequence >= 0) std::cout << level.sequence + 1;
+            else                     std::cout << "-";
+            if (level.flags & LEVEL_HARD) std::cout << "\thard";
+            std::cout << std::endl;
+        }
+        return 0;
+    }
+    
+    /* Look for copies and near copies of levels */
+    if (!similar.empty() || duplicates)
+    {
+        return find_similar(selected, frompack.empty() ? nullptr : &pack, similar) ? 0 : 1;
+    }
+    
+    /* Combine the manifests of a sharded run */
+    if (!merges.empty())
+    {
+        return merge_manifests(merges[0], std::vector<std::string>(merges.begin() + 1, merges.end())) ? 0 : 1;
+    }
+    
+    /* Play recorded input against levels */
+    if (!replays.empty())
+    {
+        return simulate_replays(replays) ? 0 : 1;
+    }
+    
+    /* Sprites are decoded natively; Magick is only started by the outputs
+     * that need it */
+    load_sprite_bitmaps();
+    if (map_format == MAP_SVG) load_svg_symbols();
+    
+    /* Stream the player's view of a level to stdout */
+    if (!viewport.empty())
+    {
+        return write_viewport(viewport, video_format) ? 0 : 1;
+    }
+    
+    /* Preview levels in the terminal instead of writing files */
+    if (map_format == MAP_TTY || map_format == MAP_SIXEL)
+    {
+        show_levels(selected, frompack.empty() ? nullptr : &pack);
+        return 0;
+    }
+    
+    /* Check raw level files without rendering them */
+    if (!validates.empty())
+    {
+        bool valid = true;
+        for (const std::string & file : validates)
+        {
+            std::ifstream in(file, std::ios::binary);
+            std::vector<uint8_t> level((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            const char * error = in ? validate_level(level.data(), level.size()) : "could not be read";
+            if (error)
+            {
+                std::cout << file << ": " << error << std::endl;
+                valid = false;
+            }
+        }
+        return valid ? 0 : 1;
+    }
+    
+#ifndef NO_MAGICK
+    /* Convert images (or all frames of an animation) to sprite data */
+    if (!encodes.empty())
+    {
+        init_magick(*argv);
+        bool failed = false;
+        for (const std::string & file : encodes)
+        {
+            std::string name = file_stem(file);
+            if (encode_masked) name += "_plus_mask";
+            
+            std::vector<Bitmap> frames;
+            try
+            {
+                std::vector<Image> images;
+                readImages(&images, file);
+                for (const Image & image : images)
+                {
+                    frames.push_back(image_bitmap(image));
+                }
+            }
+            catch (const Exception & e)
+            {
+                std::cerr << file << ": " << e.what() << std::endl;
+                failed = true;
+                continue;
+            }
+            
+            std::vector<uint8_t> sprite;
+            const char * error = encode_arduboy(frames, sprite, encode_masked);
+            if (error)
+            {
+                std::cerr << file << ": " << error << std::endl;
+                failed = true;
+                continue;
+            }
+            print_sprite(std::cout, name, sprite, encode_masked);
+        }
+        return failed ? 1 : 0;
+    }
+#endif
+    
+    /* Encoded files are written in the background while rendering continues */
+    FileWriter writer;
+    if (!archive.empty() && !writer.openArchive(archive))
+    {
+        return 1;
+    }
+    auto finish = [&]()
+    {
+        bool ok = writer.finish();
+        if (!archive.empty()) ok = write_manifest(archive + ".manifest", writer.archived(), shard, shards) && ok;
+        return ok;
+    };
+    
+    if (export_all)
+    {
+        export_assets(writer);
+        return finish() ? 0 : 1;
+    }
+    
+    if (poster)
+    {
+        write_poster(selected, frompack.empty() ? nullptr : &pack, writer);
+        return finish() ? 0 : 1;
+    }
+    
+    if (heatmap)
+    {
+        write_heatmap(selected, frompack.empty() ? nullptr : &pack, writer);
+        return finish() ? 0 : 1;
+    }
+    
+    if (!manifest.empty())
+    {
+#ifndef NO_MAGICK
+        if (!refdir.empty()) init_magick(*argv);
+#endif
+        return check_golden(manifest, refdir, update_manifest) ? 0 : 1;
+    }
+    
+#ifndef NO_MAGICK
+    /* Convert images back to levels instead of generating maps */
+    if (!imports.empty())
+    {
+        init_magick(*argv);
+        MapImporter importer;
+        bool failed = false;
+        for (const std::string & file : imports)
+        {
+            std::vector<uint8_t> level;
+            try
+            {
+                level = importer.convert(Image(file));
+            }
+            catch (const Exception & e)
+            {
+                std::cerr << file << ": " << e.what() << std::endl;
+                failed = true;
+                continue;
+            }
+            print_level(std::cout, file_stem(file), level);
+        }
+        return failed ? 1 : 0;
+    }
+#endif
+    
+    /* Sprites are only written along with the full set of levels, by the
+     * first shard */
+    if (selectors.empty() && frompack.empty() && shard == 0)
+    {
+        /* Re-combine the title screen image */
+        Bitmap title = append_bitmaps(decode_arduboy(titleScreen, sizeof(titleScreen)));
+        writer.write("title.png", encode_png(title));
+        
+        /* Save sprites to disk to confirm behaviour */
+        writer.write("kidSprite.gif", encode_gif(sprite_bitmaps[SPRITE_KID], ANIM_DELAY));
+        writer.write("walkerSprite.gif", encode_gif(sprite_bitmaps[SPRITE_WALKER], ANIM_DELAY));
+        writer.write("sprSpikes.gif", encode_gif(sprite_bitmaps[SPRITE_SPIKES], ANIM_DELAY));
+        writer.write("fan.gif", encode_gif(sprite_bitmaps[SPRITE_FAN], ANIM_DELAY));
+        writer.write("tileSetTwo.gif", encode_gif(sprite_bitmaps[SPRITE_TILES], ANIM_DELAY));
+        writer.write("door.gif", encode_gif(sprite_bitmaps[SPRITE_DOOR], ANIM_DELAY));
+        writer.write("elements.gif", encode_gif(sprite_bitmaps[SPRITE_ELEMENTS], ANIM_DELAY));
+        
+        /* Sprites with their own masks keep their transparency */
+        writer.write("selector.gif", encode_gif(
+            decode_arduboy_plus_mask(selector_plus_mask, sizeof(selector_plus_mask)), ANIM_DELAY));
+        writer.write("kidSpriteSuck.gif", encode_gif(
+            decode_arduboy_plus_mask(kidSpriteSuck_plus_mask, sizeof(kidSpriteSuck_plus_mask)), ANIM_DELAY));
+        writer.write("balloon.gif", encode_gif(
+            decode_arduboy_plus_mask(balloon_plus_mask, sizeof(balloon_plus_mask)), ANIM_DELAY));
+    }
+    
+#ifndef NO_MAGICK
+    if (map_format == MAP_GIF) init_magick(*argv);
+#endif
+    
+    /* Generate map images.
+     * Note: Not all maps are used (even numbered ones), and some non-numbered ones are
+     * used in the primary sequence. The registry knows which ones. */
+    std::vector<std::string> reports(routes ? selected.size() : 0);
+    parallel_for(selected.size(), [&](size_t i)
+    {
+        std::string * report = routes ? &reports[i] : nullptr;
+        if (!frompack.empty())
+        {
+            size_t length;
+            const uint8_t * data = pack.level(selected[i], length);
+            write_map(data, length, pack.name(selected[i]), writer, report);
+            return;
+        }
+        
+        const LevelInfo & level = level_registry[selected[i]];
+        write_map(level.data, level.length, level.name, writer, report);
+    });
+    for (const std::string & report : reports)
+    {
+        if (!report.empty()) std::cout << report << std::endl;
+    }
+
+    return finish() ? 0 : 1;
+}
+catch (const std::exception & e)
+{
+    std::cerr << e.what() << std::endl;
+    return 1;
 }
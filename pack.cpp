@@ -0,0 +1,254 @@
+#include "pack.h"
+
+#include <iostream>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "globals.h"
+
+static const char PACK_MAGIC[4] = {'M', 'B', 'P', 'I'};
+static const uint32_t PACK_VERSION = 1;
+static const size_t PACK_MAX_NAME = 255;
+
+
+/** FNV-1a hash of a level name */
+static uint32_t name_hash(const char * name, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/** Length of the level starting at data, up to and including its 0xFF,
+ * or 0 if it does not end within the available bytes */
+static size_t level_length(const uint8_t * data, size_t available)
+{
+    size_t pos = LEVEL_CELL_BYTES;
+    while (pos < available)
+    {
+        if (data[pos] == 0xFF) return pos + 1;
+        pos += ((data[pos] & 0xE0) == LFAN) ? 3 : 2;
+    }
+    return 0;
+}
+
+static bool write_all(int fd, const void * buf, size_t length, off_t offset)
+{
+    const uint8_t * bytes = (const uint8_t *)buf;
+    while (length > 0)
+    {
+        ssize_t written = pwrite(fd, bytes, length, offset);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        bytes += written;
+        length -= written;
+        offset += written;
+    }
+    return true;
+}
+
+LevelPack::LevelPack() :
+    data(nullptr), length(0), entries(nullptr), count(0),
+    indexmap(nullptr), indexlength(0)
+{
+}
+
+LevelPack::~LevelPack()
+{
+    close();
+}
+
+void LevelPack::close()
+{
+    if (data) munmap((void *)data, length);
+    if (indexmap) munmap(indexmap, indexlength);
+    data = nullptr;
+    length = 0;
+    entries = nullptr;
+    count = 0;
+    indexmap = nullptr;
+    indexlength = 0;
+}
+
+bool LevelPack::open(const std::string & file)
+{
+    close();
+    
+    int fd = ::open(file.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) < 0)
+    {
+        std::cerr << file << ": " << strerror(errno) << std::endl;
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    length = info.st_size;
+    if (length > 0)
+    {
+        void * map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            std::cerr << file << ": " << strerror(errno) << std::endl;
+            ::close(fd);
+            length = 0;
+            return false;
+        }
+        data = (const uint8_t *)map;
+    }
+    ::close(fd);
+    
+    /* Processes sharing a pack take turns bringing the index up to date,
+     * so none maps it while another is rewriting it. The first one to
+     * arrive does any rebuilding, and the rest find it current. */
+    std::string indexfile = file + ".idx";
+    fd = ::open(indexfile.c_str(), O_RDWR | O_CREAT, 0644);
+    int locked = -1;
+    if (fd >= 0)
+    {
+        do locked = flock(fd, LOCK_EX);
+        while (locked < 0 && errno == EINTR);
+    }
+    if (locked < 0 || !update(file, fd) || fstat(fd, &info) < 0)
+    {
+        std::cerr << indexfile << ": " << strerror(errno) << std::endl;
+        if (fd >= 0) ::close(fd);
+        close();
+        return false;
+    }
+    
+    indexlength = info.st_size;
+    indexmap = mmap(nullptr, indexlength, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (indexmap == MAP_FAILED)
+    {
+        std::cerr << indexfile << ": " << strerror(errno) << std::endl;
+        indexmap = nullptr;
+        close();
+        return false;
+    }
+    
+    const Header * header = (const Header *)indexmap;
+    if (indexlength < sizeof(Header) || (indexlength - sizeof(Header)) / sizeof(Entry) < header->count)
+    {
+        std::cerr << indexfile << ": index is shorter than its entry count" << std::endl;
+        close();
+        return false;
+    }
+    entries = (const Entry *)(header + 1);
+    count = header->count;
+    return true;
+}
+
+/** Brings the index up to date with the pack, indexing only the records
+ * added since it was last written. Returns false if the index cannot be
+ * read or written. */
+bool LevelPack::update(const std::string & file, int fd)
+{
+    Header header;
+    struct stat info;
+    if (fstat(fd, &info) < 0) return false;
+    
+    /* Keep what is indexed as long as it still describes the start of the
+     * pack, down to the name of its last record */
+    bool valid = (size_t)info.st_size >= sizeof(header) &&
+                 pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                 memcmp(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC)) == 0 &&
+                 header.version == PACK_VERSION && header.covered <= length &&
+                 (size_t)info.st_size == sizeof(header) + header.count * sizeof(Entry);
+    if (valid && header.count > 0)
+    {
+        Entry last;
+        off_t where = sizeof(header) + (header.count - 1) * sizeof(Entry);
+        valid = pread(fd, &last, sizeof(last), where) == (ssize_t)sizeof(last) &&
+                last.offset + last.length == header.covered &&
+                last.hash == name_hash((const char *)data + last.offset,
+                    strnlen((const char *)data + last.offset, last.length));
+    }
+    if (!valid)
+    {
+        memcpy(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+        header.version = PACK_VERSION;
+        header.covered = 0;
+        header.count = 0;
+        if (ftruncate(fd, sizeof(header)) < 0) return false;
+    }
+    if (valid && header.covered == length) return true;
+    
+    std::vector<Entry> added;
+    uint64_t pos = header.covered;
+    while (pos < length)
+    {
+        const char * name = (const char *)data + pos;
+        size_t available = length - pos;
+        const char * end = (const char *)memchr(name, 0, std::min(available, PACK_MAX_NAME + 1));
+        size_t level = end ? level_length((const uint8_t *)end + 1, available - (end - name) - 1) : 0;
+        if (!level)
+        {
+            std::cerr << file << ": no complete level at offset " << pos
+                      << ", indexing the " << header.count + added.size() << " levels before it" << std::endl;
+            break;
+        }
+        
+        Entry entry = {pos, (uint32_t)(end - name + 1 + level), name_hash(name, end - name)};
+        added.push_back(entry);
+        pos += entry.length;
+    }
+    
+    /* Entries go in before the header that counts them */
+    off_t where = sizeof(header) + header.count * sizeof(Entry);
+    if (!write_all(fd, added.data(), added.size() * sizeof(Entry), where)) return false;
+    header.covered = pos;
+    header.count += added.size();
+    return write_all(fd, &header, sizeof(header), 0);
+}
+
+std::string LevelPack::name(size_t i) const
+{
+    const char * name = (const char *)data + entries[i].offset;
+    return std::string(name, strnlen(name, entries[i].length));
+}
+
+const uint8_t * LevelPack::level(size_t i, size_t & size) const
+{
+    size_t namelength = strnlen((const char *)data + entries[i].offset, entries[i].length);
+    size = entries[i].length - namelength - 1;
+    return data + entries[i].offset + namelength + 1;
+}
+
+size_t LevelPack::find(const std::string & name) const
+{
+    uint32_t hash = name_hash(name.data(), name.size());
+    for (size_t i = 0; i < count; i++)
+    {
+        if (entries[i].hash == hash && this->name(i) == name) return i;
+    }
+    return count;
+}
+
+bool LevelPack::append(const std::string & file, const std::string & name, const uint8_t * level, size_t size)
+{
+    int fd = ::open(file.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        std::cerr << file << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    
+    std::vector<uint8_t> record(name.begin(), name.end());
+    record.push_back(0);
+    record.insert(record.end(), level, level + size);
+    bool ok = write(fd, record.data(), record.size()) == (ssize_t)record.size();
+    if (!ok) std::cerr << file << ": " << strerror(errno) << std::endl;
+    ::close(fd);
+    return ok;
+}
@@ -0,0 +1,78 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/** A file holding many levels, read through a sidecar index (pack.idx) so
+ * that any level is found without scanning the ones before it.
+ *
+ * Each record in a pack is the level's name, a NUL byte, then the level
+ * as it is stored in bitmaps.h: the tile bytes and the object records up
+ * to 0xFF. Because object records vary in size, finding where a level
+ * ends means walking all of them; the index does that once and keeps the
+ * offset, length and name hash of every record. Both files are memory
+ * mapped. An index that covers only the start of the pack, because
+ * levels were appended since, is extended by scanning just the new
+ * records, and one that does not fit the pack is rebuilt. Updates take
+ * an exclusive lock on the index, so processes can open the same pack at
+ * once. */
+class LevelPack
+{
+    public:
+        LevelPack();
+        ~LevelPack();
+        
+        /** Opens a pack, bringing its index up to date. Returns false if
+         * either file cannot be used; the error is printed to stderr. */
+        bool open(const std::string & file);
+        
+        /** Number of levels in the pack */
+        size_t size() const
+        {
+            return count;
+        }
+        
+        std::string name(size_t i) const;
+        
+        /** The level data of record i, without its name */
+        const uint8_t * level(size_t i, size_t & length) const;
+        
+        /** Index of the first level with the given name, or size() */
+        size_t find(const std::string & name) const;
+        
+        /** Appends a level to the end of a pack file, creating it if
+         * needed. The index catches up the next time the pack is opened. */
+        static bool append(const std::string & file, const std::string & name, const uint8_t * data, size_t length);
+    
+    protected:
+        /* One record of the pack, as stored in the index */
+        struct Entry
+        {
+            uint64_t offset;        // start of the record (its name)
+            uint32_t length;        // of the whole record
+            uint32_t hash;          // FNV-1a of the name
+        };
+        
+        /* Start of the index file */
+        struct Header
+        {
+            char magic[4];
+            uint32_t version;
+            uint64_t covered;       // bytes of the pack indexed
+            uint64_t count;
+        };
+        
+        const uint8_t * data;
+        size_t length;
+        const Entry * entries;
+        size_t count;
+        void * indexmap;
+        size_t indexlength;
+        
+        void close();
+        bool update(const std::string & file, int fd);
+};
+
+#endif
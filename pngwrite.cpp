@@ -0,0 +1,113 @@
+#include "pngwrite.h"
+
+#include <stdexcept>
+#include <string>
+#include <zlib.h>
+
+
+/** Appends a 32-bit big-endian value */
+static void put32(std::vector<uint8_t> & out, uint32_t value)
+{
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+/** Appends a chunk with its length and CRC */
+static void chunk(std::vector<uint8_t> & out, const char * type, const std::vector<uint8_t> & data)
+{
+    put32(out, data.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    put32(out, crc32(0, &out[start], out.size() - start));
+}
+
+/** Compresses filtered scanlines and wraps them in the PNG chunks */
+static std::vector<uint8_t> encode(size_t width, size_t height, uint8_t depth, uint8_t colour,
+                                   const std::vector<uint8_t> & raw)
+{
+    uLongf packedsize = compressBound(raw.size());
+    std::vector<uint8_t> packed(packedsize);
+    int result = compress2(packed.data(), &packedsize, raw.data(), raw.size(), Z_BEST_COMPRESSION);
+    if (result != Z_OK)
+    {
+        throw std::runtime_error(std::string("PNG compression failed: ") + zError(result));
+    }
+    packed.resize(packedsize);
+    
+    std::vector<uint8_t> header;
+    put32(header, width);
+    put32(header, height);
+    header.push_back(depth);                                // bit depth
+    header.push_back(colour);                               // gray, RGB, or gray and alpha
+    header.push_back(0);                                    // deflate
+    header.push_back(0);                                    // adaptive filtering
+    header.push_back(0);                                    // not interlaced
+    
+    std::vector<uint8_t> out = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    chunk(out, "IHDR", header);
+    chunk(out, "IDAT", packed);
+    chunk(out, "IEND", {});
+    
+    return out;
+}
+
+std::vector<uint8_t> encode_png(const Bitmap & bitmap)
+{
+    bool bilevel = bitmap.alpha.empty();
+    for (size_t i = 0; i < bitmap.pixels.size() && bilevel; i++)
+    {
+        bilevel = bitmap.pixels[i] == 0x00 || bitmap.pixels[i] == 0xFF;
+    }
+    
+    /* Scanlines, each starting with filter type 0 (none) */
+    std::vector<uint8_t> raw;
+    for (size_t y = 0; y < bitmap.height; y++)
+    {
+        const uint8_t * row = &bitmap.pixels[y * bitmap.width];
+        raw.push_back(0);
+        if (bilevel)
+        {
+            for (size_t x = 0; x < bitmap.width; x += 8)
+            {
+                uint8_t bits = 0;
+                for (size_t bit = 0; bit < 8; bit++)
+                {
+                    bits |= (x + bit < bitmap.width && row[x + bit]) << (7 - bit);
+                }
+                raw.push_back(bits);
+            }
+        }
+        else if (!bitmap.alpha.empty())
+        {
+            const uint8_t * alpha = &bitmap.alpha[y * bitmap.width];
+            for (size_t x = 0; x < bitmap.width; x++)
+            {
+                raw.push_back(row[x]);
+                raw.push_back(alpha[x]);
+            }
+        }
+        else
+        {
+            raw.insert(raw.end(), row, row + bitmap.width);
+        }
+    }
+    
+    return encode(bitmap.width, bitmap.height, bilevel ? 1 : 8, bitmap.alpha.empty() ? 0 : 4, raw);
+}
+
+std::vector<uint8_t> encode_png_rgb(size_t width, size_t height, const std::vector<uint8_t> & rgb)
+{
+    std::vector<uint8_t> raw;
+    raw.reserve((width * 3 + 1) * height);
+    for (size_t y = 0; y < height; y++)
+    {
+        const uint8_t * row = &rgb[y * width * 3];
+        raw.push_back(0);
+        raw.insert(raw.end(), row, row + width * 3);
+    }
+    
+    return encode(width, height, 8, 2, raw);
+}
@@ -0,0 +1,17 @@
+#ifndef PNGWRITE_H
+#define PNGWRITE_H
+
+#include <vector>
+#include <cstdint>
+#include "bitmap.h"
+
+/** Encodes a bitmap as a PNG file. Pure black and white bitmaps, such as
+ * maps, are stored with 1 bit per pixel; bitmaps with an alpha plane are
+ * stored as gray plus alpha. Both encoders throw std::runtime_error if
+ * zlib fails, rather than return a corrupt file. */
+std::vector<uint8_t> encode_png(const Bitmap & bitmap);
+
+/** Encodes 8-bit RGB pixels, three bytes each row by row, as a PNG file */
+std::vector<uint8_t> encode_png_rgb(size_t width, size_t height, const std::vector<uint8_t> & rgb);
+
+#endif
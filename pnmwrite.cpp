@@ -0,0 +1,40 @@
+#include "pnmwrite.h"
+
+#include <string>
+
+
+static std::vector<uint8_t> header(const char * magic, const Bitmap & bitmap)
+{
+    std::string text = std::string(magic) + "\n" + std::to_string(bitmap.width) + " " +
+                       std::to_string(bitmap.height) + "\n";
+    if (magic[1] == '5') text += "255\n";
+    return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+std::vector<uint8_t> encode_pbm(const Bitmap & bitmap)
+{
+    std::vector<uint8_t> out = header("P4", bitmap);
+    size_t stride = (bitmap.width + 7) / 8;
+    size_t start = out.size();
+    out.resize(start + stride * bitmap.height, 0);
+    
+    /* Rows are packed most significant bit first */
+    for (size_t y = 0; y < bitmap.height; y++)
+    {
+        const uint8_t * row = &bitmap.pixels[y * bitmap.width];
+        uint8_t * packed = &out[start + y * stride];
+        for (size_t x = 0; x < bitmap.width; x++)
+        {
+            if (row[x] < 0x80) packed[x >> 3] |= 0x80 >> (x & 7);
+        }
+    }
+    
+    return out;
+}
+
+std::vector<uint8_t> encode_pgm(const Bitmap & bitmap)
+{
+    std::vector<uint8_t> out = header("P5", bitmap);
+    out.insert(out.end(), bitmap.pixels.begin(), bitmap.pixels.end());
+    return out;
+}
@@ -0,0 +1,16 @@
+#ifndef PNMWRITE_H
+#define PNMWRITE_H
+
+#include <vector>
+#include <cstdint>
+#include "bitmap.h"
+
+/** Encodes a bitmap as an uncompressed binary PBM (P4), with one bit per
+ * pixel: 1 for pixels darker than mid gray */
+std::vector<uint8_t> encode_pbm(const Bitmap & bitmap);
+
+/** Encodes a bitmap as an uncompressed binary PGM (P5) of its gray
+ * values. Alpha is dropped. */
+std::vector<uint8_t> encode_pgm(const Bitmap & bitmap);
+
+#endif
@@ -0,0 +1,89 @@
+#include "qoiwrite.h"
+
+
+/* Chunk tags */
+static const uint8_t QOI_OP_INDEX = 0x00;
+static const uint8_t QOI_OP_DIFF = 0x40;
+static const uint8_t QOI_OP_LUMA = 0x80;
+static const uint8_t QOI_OP_RUN = 0xC0;
+static const uint8_t QOI_OP_RGB = 0xFE;
+static const uint8_t QOI_OP_RGBA = 0xFF;
+
+/** Appends a 32-bit big-endian value */
+static void put32(std::vector<uint8_t> & out, uint32_t value)
+{
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+std::vector<uint8_t> encode_qoi(const Bitmap & bitmap)
+{
+    bool alpha = !bitmap.alpha.empty();
+    std::vector<uint8_t> out = {'q', 'o', 'i', 'f'};
+    out.reserve(14 + bitmap.pixels.size() / 8 + 8);
+    put32(out, bitmap.width);
+    put32(out, bitmap.height);
+    out.push_back(alpha ? 4 : 3);
+    out.push_back(0);                                       // sRGB
+    
+    /* Pixels are gray, so only the value and alpha need tracking; the
+     * previous pixel starts out as opaque black */
+    uint8_t seen[64][2] = {};
+    uint8_t value = 0, opacity = 0xFF;
+    size_t run = 0;
+    for (size_t i = 0; i < bitmap.pixels.size(); i++)
+    {
+        uint8_t v = bitmap.pixels[i];
+        uint8_t a = alpha ? bitmap.alpha[i] : 0xFF;
+        if (v == value && a == opacity)
+        {
+            if (++run == 62)
+            {
+                out.push_back(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run)
+        {
+            out.push_back(QOI_OP_RUN | (run - 1));
+            run = 0;
+        }
+        
+        size_t slot = (v * 3 + v * 5 + v * 7 + a * 11) % 64;
+        if (seen[slot][0] == v && seen[slot][1] == a)
+        {
+            out.push_back(QOI_OP_INDEX | slot);
+        }
+        else if (a != opacity)
+        {
+            out.push_back(QOI_OP_RGBA);
+            out.insert(out.end(), {v, v, v, a});
+        }
+        else
+        {
+            /* Every channel changes by the same amount */
+            int8_t d = (int8_t)(uint8_t)(v - value);
+            if (d >= -2 && d <= 1)
+                out.push_back(QOI_OP_DIFF | (d + 2) << 4 | (d + 2) << 2 | (d + 2));
+            else if (d >= -32 && d <= 31)
+                out.insert(out.end(), {(uint8_t)(QOI_OP_LUMA | (d + 32)), 0x88});
+            else
+            {
+                out.push_back(QOI_OP_RGB);
+                out.insert(out.end(), {v, v, v});
+            }
+        }
+        
+        seen[slot][0] = v;
+        seen[slot][1] = a;
+        value = v;
+        opacity = a;
+    }
+    if (run) out.push_back(QOI_OP_RUN | (run - 1));
+    
+    out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+    return out;
+}
@@ -0,0 +1,13 @@
+#ifndef QOIWRITE_H
+#define QOIWRITE_H
+
+#include <vector>
+#include <cstdint>
+#include "bitmap.h"
+
+/** Encodes a bitmap as a QOI image, which is lossless like PNG but much
+ * cheaper to write and read. Gray pixels become RGB, and bitmaps with an
+ * alpha plane are stored as RGBA. */
+std::vector<uint8_t> encode_qoi(const Bitmap & bitmap);
+
+#endif
@@ -0,0 +1,171 @@
+# Generates the asset and level registry (registry.inc) from bitmaps.h.
+#
+# Every unsigned char array is treated as a sprite. Arrays normally start
+# with a width, height header; arrays without one take their width from
+# the number of values on the first line of data. Arrays that fit neither
+# shape are listed as comments so they are easy to spot.
+#
+# Every uint8_t array holding at least the tile block and ending in 0xFF
+# is a level. Its sequence number is its position in the levels[] table
+# (-1 if it is not played), and it is flagged as hard mode if its name or
+# the comment on its declaration mentions it.
+#
+# Usage: awk -f registry.awk bitmaps.h > registry.inc
+
+function value(tok)
+{
+    if (tok ~ /^0[xX]/) return hexvalue(substr(tok, 3));
+    if (tok ~ /^0[bB]/) return binvalue(substr(tok, 3));
+    return tok + 0;
+}
+
+function hexvalue(digits,    i, result)
+{
+    result = 0;
+    for (i = 1; i <= length(digits); i++)
+        result = result * 16 + index("0123456789abcdef", tolower(substr(digits, i, 1))) - 1;
+    return result;
+}
+
+function binvalue(digits,    i, result)
+{
+    result = 0;
+    for (i = 1; i <= length(digits); i++)
+        result = result * 2 + substr(digits, i, 1);
+    return result;
+}
+
+function finish(    width, height, layout, frame)
+{
+    if (type == "uint8_t" && count > LEVEL_CELL_BYTES && vals[count - 1] == 255)
+    {
+        levelnames[numlevels] = name;
+        levelhard[numlevels] = hard;
+        numlevels++;
+        return;
+    }
+
+    if (type != "unsigned char") return;
+
+    layout = (name ~ /_plus_mask$/) ? "ASSET_PLUS_MASK" : "ASSET_PLAIN";
+    width = vals[0];
+    height = vals[1];
+    frame = width * height / 8 * (layout == "ASSET_PLUS_MASK" ? 2 : 1);
+    if (count > 2 && width > 0 && height > 0 && height % 8 == 0 && (count - 2) % frame == 0)
+    {
+        printf "ASSET(%s, %d, %d, %s)\n", name, width, height, layout;
+        return;
+    }
+
+    width = firstline;
+    if (layout == "ASSET_PLAIN" && width > 0 && count % width == 0)
+    {
+        printf "ASSET(%s, %d, %d, ASSET_RAW)\n", name, width, count / width * 8;
+        return;
+    }
+
+    printf "/* %s: unknown layout, %d bytes */\n", name, count;
+}
+
+BEGIN {
+    print "/* Generated from bitmaps.h by registry.awk. Do not edit. */";
+    LEVEL_CELL_BYTES = 72;
+    incomment = 0;
+    inarray = 0;
+    insequence = 0;
+    numlevels = 0;
+    numsequence = 0;
+}
+
+END {
+    for (i = 0; i < numlevels; i++)
+    {
+        seq = (levelnames[i] in sequence) ? sequence[levelnames[i]] : -1;
+        flags = (seq >= 0) ? "LEVEL_ENABLED" : "0";
+        if (levelhard[i]) flags = flags " | LEVEL_HARD";
+        sub(/^0 \| /, "", flags);
+        printf "LEVEL(%s, %d, %s)\n", levelnames[i], seq, flags;
+    }
+}
+
+{
+    line = $0;
+    raw = $0;
+
+    # Strip block comments, which may span lines, then line comments
+    out = "";
+    while (line != "")
+    {
+        if (incomment)
+        {
+            end = index(line, "*/");
+            if (!end) { line = ""; break; }
+            line = substr(line, end + 2);
+            incomment = 0;
+        }
+        else
+        {
+            start = index(line, "/*");
+            if (!start) { out = out line; break; }
+            out = out substr(line, 1, start - 1);
+            line = substr(line, start + 2);
+            incomment = 1;
+        }
+    }
+    line = out;
+    sub(/\/\/.*/, "", line);
+
+    # The play order, where commented out entries are already gone
+    if (line ~ /\* *levels *\[\]/)
+    {
+        insequence = 1;
+        line = substr(line, index(line, "{") + 1);
+    }
+    if (insequence)
+    {
+        done = index(line, "}");
+        if (done) line = substr(line, 1, done - 1);
+        while (match(line, /[A-Za-z_][A-Za-z0-9_]*/))
+        {
+            sequence[substr(line, RSTART, RLENGTH)] = numsequence++;
+            line = substr(line, RSTART + RLENGTH);
+        }
+        if (done) insequence = 0;
+        next;
+    }
+
+    if (!inarray && line ~ /const +(unsigned char|byte|uint8_t)[^*]*\[\]/)
+    {
+        match(line, /[A-Za-z_][A-Za-z0-9_]* *\[\]/);
+        name = substr(line, RSTART, RLENGTH);
+        sub(/ *\[\]/, "", name);
+        match(line, /unsigned char|byte|uint8_t/);
+        type = substr(line, RSTART, RLENGTH);
+
+        hard = (tolower(name) ~ /hard/ || tolower(substr(raw, length(line) + 1)) ~ /hard/);
+        inarray = 1;
+        count = 0;
+        firstline = 0;
+        line = substr(line, index(line, "=") + 1);
+    }
+
+    if (!inarray) next;
+
+    done = index(line, "}");
+    if (done) line = substr(line, 1, done - 1);
+
+    n = 0;
+    while (match(line, /0[xX][0-9A-Fa-f]+|0[bB][01]+|[0-9]+/))
+    {
+        vals[count++] = value(substr(line, RSTART, RLENGTH));
+        line = substr(line, RSTART + RLENGTH);
+        n++;
+    }
+    if (n && !firstline) firstline = n;
+
+    if (done)
+    {
+        finish();
+        inarray = 0;
+    }
+}
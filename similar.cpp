@@ -0,0 +1,204 @@
+#include "similar.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "globals.h"
+
+/* Levels compared with each earlier level sharing a bucket, at most */
+static const size_t CLUSTER_WINDOW = 8;
+
+/* Kinds of feature, kept apart in the top byte */
+static const uint64_t FEATURE_ROW = 1ULL << 56;
+static const uint64_t FEATURE_ROW_PAIR = 2ULL << 56;
+static const uint64_t FEATURE_OBJECT = 3ULL << 56;
+
+
+/** Scrambles a 64-bit value (the splitmix64 finaliser) */
+static uint64_t mix(uint64_t value)
+{
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+/** Multipliers and offsets of the hash family. Each feature is scrambled
+ * once, and the family only multiplies and adds, taking the high bits. */
+struct HashFamily
+{
+    uint64_t a[SIGNATURE_HASHES];
+    uint64_t b[SIGNATURE_HASHES];
+    
+    HashFamily()
+    {
+        uint64_t seed = 0x6D62736967ULL;
+        for (size_t k = 0; k < SIGNATURE_HASHES; k++)
+        {
+            a[k] = mix(seed++) | 1;
+            b[k] = mix(seed++);
+        }
+    }
+};
+
+static const HashFamily family;
+
+/** Lowers the signature to take in one feature */
+static void add_feature(Signature & signature, uint64_t feature)
+{
+    uint64_t hash = mix(feature);
+    for (size_t k = 0; k < SIGNATURE_HASHES; k++)
+    {
+        uint32_t value = (family.a[k] * hash + family.b[k]) >> 32;
+        signature.hashes[k] = std::min(signature.hashes[k], value);
+    }
+}
+
+Signature level_signature(const uint8_t * level, size_t length)
+{
+    Signature signature;
+    std::fill(signature.hashes, signature.hashes + SIGNATURE_HASHES, UINT32_MAX);
+    
+    /* Tile rows, 24 bits each */
+    const size_t rowbytes = LEVEL_WIDTH_CELLS / 8;
+    uint64_t previous = 0;
+    for (size_t y = 0; y < LEVEL_HEIGHT_CELLS && (y + 1) * rowbytes <= length; y++)
+    {
+        uint64_t row = 0;
+        for (size_t i = 0; i < rowbytes; i++)
+        {
+            row |= (uint64_t)level[y * rowbytes + i] << (i * 8);
+        }
+        add_feature(signature, FEATURE_ROW | y << 24 | row);
+        if (y > 0) add_feature(signature, FEATURE_ROW_PAIR | y << 48 | previous << 24 | row);
+        previous = row;
+    }
+    
+    /* Object records, of 2 bytes or 3 for fans */
+    size_t pos = LEVEL_CELL_BYTES;
+    while (pos < length && level[pos] != 0xFF)
+    {
+        size_t size = ((level[pos] & 0xE0) == LFAN) ? 3 : 2;
+        if (pos + size > length) break;
+        
+        uint64_t record = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            record = record << 8 | level[pos + i];
+        }
+        add_feature(signature, FEATURE_OBJECT | record);
+        pos += size;
+    }
+    
+    return signature;
+}
+
+double signature_similarity(const Signature & a, const Signature & b)
+{
+    size_t equal = 0;
+    for (size_t k = 0; k < SIGNATURE_HASHES; k++)
+    {
+        equal += a.hashes[k] == b.hashes[k];
+    }
+    return (double)equal / SIGNATURE_HASHES;
+}
+
+/** Hash of one band of a signature */
+static uint64_t band_key(const Signature & signature, size_t band)
+{
+    uint64_t key = band;
+    for (size_t row = 0; row < SIGNATURE_ROWS; row++)
+    {
+        key = mix(key ^ signature.hashes[band * SIGNATURE_ROWS + row]);
+    }
+    return key;
+}
+
+SimilarityIndex::SimilarityIndex(std::vector<Signature> && signatures) :
+    signatures(std::move(signatures))
+{
+    for (size_t band = 0; band < SIGNATURE_BANDS; band++)
+    {
+        bands[band].resize(this->signatures.size());
+        for (size_t i = 0; i < this->signatures.size(); i++)
+        {
+            bands[band][i] = Bucket{band_key(this->signatures[i], band), (uint32_t)i};
+        }
+        std::sort(bands[band].begin(), bands[band].end());
+    }
+}
+
+std::vector<std::pair<size_t, double>> SimilarityIndex::similar(const Signature & query, double threshold) const
+{
+    std::vector<uint32_t> candidates;
+    for (size_t band = 0; band < SIGNATURE_BANDS; band++)
+    {
+        uint64_t key = band_key(query, band);
+        auto first = std::lower_bound(bands[band].begin(), bands[band].end(), Bucket{key, 0});
+        for (auto it = first; it != bands[band].end() && it->key == key; ++it)
+        {
+            candidates.push_back(it->level);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    
+    std::vector<std::pair<size_t, double>> found;
+    for (uint32_t level : candidates)
+    {
+        double similarity = signature_similarity(query, signatures[level]);
+        if (similarity >= threshold) found.emplace_back(level, similarity);
+    }
+    std::stable_sort(found.begin(), found.end(),
+        [](const std::pair<size_t, double> & a, const std::pair<size_t, double> & b) { return a.second > b.second; });
+    return found;
+}
+
+std::vector<std::vector<size_t>> SimilarityIndex::clusters(double threshold) const
+{
+    std::vector<uint32_t> parent(signatures.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    auto root = [&](uint32_t level)
+    {
+        while (parent[level] != level)
+        {
+            level = parent[level] = parent[parent[level]];
+        }
+        return level;
+    };
+    
+    for (size_t band = 0; band < SIGNATURE_BANDS; band++)
+    {
+        const std::vector<Bucket> & buckets = bands[band];
+        size_t start = 0;
+        for (size_t i = 1; i < buckets.size(); i++)
+        {
+            if (buckets[i].key != buckets[i - 1].key)
+            {
+                start = i;
+                continue;
+            }
+            
+            for (size_t j = i; j-- > std::max(start, i - std::min(i, CLUSTER_WINDOW));)
+            {
+                uint32_t a = root(buckets[i].level), b = root(buckets[j].level);
+                if (a == b) break;
+                if (signature_similarity(signatures[buckets[i].level], signatures[buckets[j].level]) >= threshold)
+                {
+                    parent[std::max(a, b)] = std::min(a, b);
+                    break;
+                }
+            }
+        }
+    }
+    
+    std::vector<std::vector<size_t>> groups(signatures.size());
+    for (uint32_t level = 0; level < signatures.size(); level++)
+    {
+        groups[root(level)].push_back(level);
+    }
+    groups.erase(std::remove_if(groups.begin(), groups.end(),
+        [](const std::vector<size_t> & group) { return group.size() < 2; }), groups.end());
+    std::stable_sort(groups.begin(), groups.end(),
+        [](const std::vector<size_t> & a, const std::vector<size_t> & b) { return a.size() > b.size(); });
+    return groups;
+}
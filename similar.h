@@ -0,0 +1,74 @@
+#ifndef SIMILAR_H
+#define SIMILAR_H
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+/* A signature is split into bands of rows; two levels become candidates
+ * when all rows of any one band agree. With 20 bands of 3, levels that
+ * share 40% of their features are found about three times in four, and
+ * levels sharing 60% almost always. */
+static const size_t SIGNATURE_HASHES = 60;
+static const size_t SIGNATURE_BANDS = 20;
+static const size_t SIGNATURE_ROWS = SIGNATURE_HASHES / SIGNATURE_BANDS;
+
+/** MinHash signature of a level: for each of a family of hash functions,
+ * the smallest hash of any of its features. The share of equal values in
+ * two signatures estimates how many features the levels have in common
+ * (their Jaccard similarity).
+ *
+ * The features are the tile rows and pairs of neighbouring rows, each
+ * tied to its height in the level, and the object records. */
+struct Signature
+{
+    uint32_t hashes[SIGNATURE_HASHES];
+};
+
+Signature level_signature(const uint8_t * level, size_t length);
+
+/** Estimated share of features two levels have in common, from 0 to 1 */
+double signature_similarity(const Signature & a, const Signature & b);
+
+/** Finds similar levels by locality sensitive hashing: every band of
+ * every signature is hashed into a sorted table, so levels are only
+ * compared with the ones they share a band with, never all pairs. */
+class SimilarityIndex
+{
+    public:
+        explicit SimilarityIndex(std::vector<Signature> && signatures);
+        
+        size_t size() const
+        {
+            return signatures.size();
+        }
+        
+        /** Levels whose similarity to the query is at least threshold,
+         * most similar first, as (index, similarity) */
+        std::vector<std::pair<size_t, double>> similar(const Signature & query, double threshold) const;
+        
+        /** Groups of two or more levels linked by similarities of at least
+         * threshold, largest first. A level is compared with the few
+         * before it in each of its buckets, so the work stays linear
+         * even when thousands of copies of one level share a bucket. */
+        std::vector<std::vector<size_t>> clusters(double threshold) const;
+    
+    protected:
+        /* One band of one signature */
+        struct Bucket
+        {
+            uint64_t key;
+            uint32_t level;
+            
+            bool operator<(const Bucket & other) const
+            {
+                return key < other.key || (key == other.key && level < other.level);
+            }
+        };
+        
+        std::vector<Signature> signatures;
+        std::vector<Bucket> bands[SIGNATURE_BANDS];
+};
+
+#endif
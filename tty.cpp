@@ -0,0 +1,124 @@
+#include "tty.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+
+size_t tty_columns()
+{
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0)
+    {
+        return size.ws_col;
+    }
+    
+    const char * columns = getenv("COLUMNS");
+    if (columns && atoi(columns) > 0)
+    {
+        return atoi(columns);
+    }
+    return 80;
+}
+
+/** True if a scale x scale block of pixels should be drawn black. The maps
+ * are mostly thin lines, so a quarter of the block being black is enough
+ * to keep a one pixel line visible when scaled down by 4. */
+static bool block_black(const Bitmap & bitmap, size_t x, size_t y, size_t scale)
+{
+    size_t black = 0;
+    size_t total = 0;
+    for (size_t by = y; by < std::min(y + scale, bitmap.height); by++)
+    {
+        for (size_t bx = x; bx < std::min(x + scale, bitmap.width); bx++)
+        {
+            black += bitmap.pixels[by * bitmap.width + bx] < 0x80;
+            total++;
+        }
+    }
+    return black * 4 >= total && total > 0;
+}
+
+std::string tty_blocks(const Bitmap & bitmap, size_t scale)
+{
+    /* Indexed by (upper black) | (lower black) << 1 */
+    static const char * const glyphs[4] = {" ", "▀", "▄", "█"};
+    
+    std::string out;
+    for (size_t y = 0; y < bitmap.height; y += 2 * scale)
+    {
+        /* Black ink on white paper, whatever the terminal's colours are */
+        out += "\x1b[38;5;16;48;5;231m";
+        for (size_t x = 0; x < bitmap.width; x += scale)
+        {
+            int upper = block_black(bitmap, x, y, scale);
+            int lower = block_black(bitmap, x, y + scale, scale);
+            out += glyphs[upper | (lower << 1)];
+        }
+        out += "\x1b[0m\n";
+    }
+    
+    return out;
+}
+
+/** Appends one colour's pixels of a sixel band, run-length encoded */
+static void sixel_band(std::string & out, const Bitmap & bitmap, size_t y, bool black)
+{
+    char buf[32];
+    size_t x = 0;
+    while (x < bitmap.width)
+    {
+        uint8_t bits = 0;
+        for (size_t bit = 0; bit < 6 && y + bit < bitmap.height; bit++)
+        {
+            bool pixel = bitmap.pixels[(y + bit) * bitmap.width + x] < 0x80;
+            bits |= (pixel == black) << bit;
+        }
+        
+        size_t run = 1;
+        while (x + run < bitmap.width)
+        {
+            uint8_t next = 0;
+            for (size_t bit = 0; bit < 6 && y + bit < bitmap.height; bit++)
+            {
+                bool pixel = bitmap.pixels[(y + bit) * bitmap.width + x + run] < 0x80;
+                next |= (pixel == black) << bit;
+            }
+            if (next != bits) break;
+            run++;
+        }
+        
+        if (run > 3)
+        {
+            snprintf(buf, sizeof(buf), "!%zu", run);
+            out += buf;
+            out += (char)('?' + bits);
+        }
+        else
+        {
+            out.append(run, (char)('?' + bits));
+        }
+        x += run;
+    }
+}
+
+std::string tty_sixel(const Bitmap & bitmap)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "\x1bP0;1;0q\"1;1;%zu;%zu#0;2;0;0;0#1;2;100;100;100",
+        bitmap.width, bitmap.height);
+    std::string out = buf;
+    
+    for (size_t y = 0; y < bitmap.height; y += 6)
+    {
+        out += "#0";
+        sixel_band(out, bitmap, y, true);
+        out += "$#1";
+        sixel_band(out, bitmap, y, false);
+        out += "-";
+    }
+    out += "\x1b\\\n";
+    
+    return out;
+}
@@ -0,0 +1,18 @@
+#ifndef TTY_H
+#define TTY_H
+
+#include <string>
+#include "bitmap.h"
+
+/** Width of the terminal on stdout in characters, from the terminal itself
+ * or $COLUMNS, or 80 if unknown */
+size_t tty_columns();
+
+/** Draws a bitmap with Unicode half-block characters. Each character
+ * covers scale pixels across and 2 * scale pixels down. */
+std::string tty_blocks(const Bitmap & bitmap, size_t scale=1);
+
+/** Draws a bitmap at full size as DEC sixel graphics */
+std::string tty_sixel(const Bitmap & bitmap);
+
+#endif
@@ -0,0 +1,263 @@
+#include "writer.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+FileWriter::FileWriter(size_t capacity) :
+    capacity(capacity), closing(false), failed(false),
+    archivefd(-1), archiveoffset(0), thread(&FileWriter::run, this)
+{
+}
+
+FileWriter::~FileWriter()
+{
+    finish();
+}
+
+void FileWriter::write(const std::string & name, std::vector<uint8_t> && data)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    space.wait(guard, [this]() { return queue.size() < capacity; });
+    queue.push_back(Pending{name, std::move(data)});
+    ready.notify_one();
+}
+
+bool FileWriter::finish()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closing = true;
+        ready.notify_one();
+    }
+    
+    if (thread.joinable()) thread.join();
+    
+    /* A tar archive ends with two empty blocks */
+    if (archivefd >= 0)
+    {
+        std::vector<uint8_t> end(1024, 0);
+        if (!writeAll(archivefd, end.data(), end.size(), 0, archiveoffset)) error(archivename);
+        close(archivefd);
+        archivefd = -1;
+    }
+    return !failed;
+}
+
+bool FileWriter::openArchive(const std::string & name)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    archivename = name;
+    archivefd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (archivefd < 0)
+    {
+        error(name);
+        return false;
+    }
+    return true;
+}
+
+void FileWriter::run()
+{
+    std::vector<Pending> batch;
+    
+#ifdef HAVE_LIBURING
+    /* The queue never holds more than capacity files, so neither does a batch */
+    ringready = io_uring_queue_init(capacity, &ring, 0) == 0;
+#endif
+    
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            ready.wait(guard, [this]() { return closing || !queue.empty(); });
+            if (queue.empty()) break;
+            
+            /* Take everything that is waiting, so one pass covers it all */
+            batch.clear();
+            while (!queue.empty())
+            {
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+            space.notify_all();
+        }
+        
+        if (archivefd >= 0) writeArchive(batch);
+        else                writeBatch(batch);
+    }
+    
+#ifdef HAVE_LIBURING
+    if (ringready) io_uring_queue_exit(&ring);
+#endif
+}
+
+void FileWriter::error(const std::string & name)
+{
+    std::cerr << "Could not write " << name << ": " << strerror(errno) << std::endl;
+    failed = true;
+}
+
+bool FileWriter::writeAll(int fd, const uint8_t * data, size_t length, size_t offset, size_t base)
+{
+    while (offset < length)
+    {
+        ssize_t done = pwrite(fd, data + offset, length - offset, base + offset);
+        if (done < 0 && errno == EINTR) continue;
+        if (done < 0) return false;
+        if (done == 0)
+        {
+            /* Nothing written and no error, which would repeat forever */
+            errno = ENOSPC;
+            return false;
+        }
+        offset += done;
+    }
+    
+    return true;
+}
+
+/** Appends each file to the archive as a ustar member: a 512-byte header,
+ * then the data padded to a whole block. Members get a fixed time and
+ * mode, so their contents only depend on the files. */
+void FileWriter::writeArchive(std::vector<Pending> & batch)
+{
+    for (Pending & file : batch)
+    {
+        std::vector<uint8_t> header(512, 0);
+        std::string name = file.name;
+        std::string prefix;
+        if (name.size() > 100 && name.find('/') != std::string::npos)
+        {
+            size_t split = name.rfind('/', name.size() - 2);
+            prefix = name.substr(0, split);
+            name = name.substr(split + 1);
+        }
+        if (name.size() > 100 || prefix.size() > 155)
+        {
+            std::cerr << "Could not write " << file.name << ": name too long for the archive" << std::endl;
+            failed = true;
+            continue;
+        }
+        
+        memcpy(&header[0], name.data(), name.size());
+        snprintf((char *)&header[100], 8, "%07o", 0644);
+        snprintf((char *)&header[108], 8, "%07o", 0);
+        snprintf((char *)&header[116], 8, "%07o", 0);
+        snprintf((char *)&header[124], 12, "%011lo", (unsigned long)file.data.size());
+        snprintf((char *)&header[136], 12, "%011o", 0);
+        header[156] = '0';
+        memcpy(&header[257], "ustar", 6);
+        memcpy(&header[263], "00", 2);
+        memcpy(&header[345], prefix.data(), prefix.size());
+        
+        /* The checksum is taken with its own field filled with spaces */
+        memset(&header[148], ' ', 8);
+        unsigned sum = 0;
+        for (uint8_t byte : header) sum += byte;
+        snprintf((char *)&header[148], 8, "%06o", sum);
+        
+        uint64_t hash = 14695981039346656037ull;
+        for (uint8_t byte : file.data) hash = (hash ^ byte) * 1099511628211ull;
+        
+        size_t size = file.data.size();
+        size_t padded = (size + 511) & ~(size_t)511;
+        file.data.resize(padded, 0);
+        if (!writeAll(archivefd, header.data(), header.size(), 0, archiveoffset) ||
+            !writeAll(archivefd, file.data.data(), padded, 0, archiveoffset + header.size()))
+        {
+            error(archivename);
+            continue;
+        }
+        archiveoffset += header.size() + padded;
+        entries.push_back(ArchiveEntry{file.name, size, hash});
+    }
+}
+
+#ifdef HAVE_LIBURING
+
+void FileWriter::writeBatch(std::vector<Pending> & batch)
+{
+    std::vector<int> fds(batch.size(), -1);
+    size_t submitted = 0;
+    
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        fds[i] = open(batch[i].name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fds[i] < 0)
+        {
+            error(batch[i].name);
+            continue;
+        }
+        
+        /* Without a ring, write synchronously instead */
+        struct io_uring_sqe * sqe = ringready ? io_uring_get_sqe(&ring) : NULL;
+        if (!sqe)
+        {
+            if (!writeAll(fds[i], batch[i].data.data(), batch[i].data.size(), 0))
+            {
+                error(batch[i].name);
+            }
+            continue;
+        }
+        
+        io_uring_prep_write(sqe, fds[i], batch[i].data.data(), batch[i].data.size(), 0);
+        io_uring_sqe_set_data(sqe, (void *)i);
+        submitted++;
+    }
+    
+    if (submitted) io_uring_submit(&ring);
+    
+    for (size_t done = 0; done < submitted; done++)
+    {
+        struct io_uring_cqe * cqe;
+        int ret = io_uring_wait_cqe(&ring, &cqe);
+        if (ret < 0)
+        {
+            errno = -ret;
+            error("batch");
+            break;
+        }
+        
+        size_t i = (size_t)io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        
+        /* Finish short writes synchronously; they are rare for files */
+        if (res < 0)
+        {
+            errno = -res;
+            error(batch[i].name);
+        }
+        else if (!writeAll(fds[i], batch[i].data.data(), batch[i].data.size(), res))
+        {
+            error(batch[i].name);
+        }
+    }
+    
+    for (int fd : fds)
+    {
+        if (fd >= 0) close(fd);
+    }
+}
+
+#else
+
+void FileWriter::writeBatch(std::vector<Pending> & batch)
+{
+    for (Pending & file : batch)
+    {
+        int fd = open(file.name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || !writeAll(fd, file.data.data(), file.data.size(), 0))
+        {
+            error(file.name);
+        }
+        if (fd >= 0) close(fd);
+    }
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/** Writes encoded files on a background thread, so that rendering and
+ * encoding on the worker threads overlap with disk I/O.
+ * 
+ * Files are handed over through a bounded queue: write() blocks once
+ * `capacity` files are waiting, which keeps memory use in check when the
+ * disk is slower than the renderers. With liburing (make URING=1) the
+ * queued files are written as one batch of io_uring requests, otherwise
+ * they are written with plain pwrite calls.
+ * 
+ * After openArchive(), files go into one uncompressed tar archive instead,
+ * in the order they were queued, and their names, sizes and hashes are
+ * kept for a manifest. */
+class FileWriter
+{
+    public:
+        FileWriter(size_t capacity=64);
+        ~FileWriter();
+        
+        /** Queues a file to be written. Takes ownership of the data. */
+        void write(const std::string & name, std::vector<uint8_t> && data);
+        
+        /** Waits until every queued file is written. Returns false if any
+         * file could not be written; the errors are printed to stderr. */
+        bool finish();
+        
+        /** Writes every file from now on into a tar archive. Returns false
+         * if it cannot be created. */
+        bool openArchive(const std::string & name);
+        
+        /* A file written to the archive */
+        struct ArchiveEntry
+        {
+            std::string name;
+            size_t size;
+            uint64_t hash;      // FNV-1a of the contents
+        };
+        
+        /** Files written to the archive so far; complete after finish() */
+        const std::vector<ArchiveEntry> & archived() const
+        {
+            return entries;
+        }
+        
+    protected:
+        struct Pending
+        {
+            std::string name;
+            std::vector<uint8_t> data;
+        };
+        
+        std::deque<Pending> queue;
+        size_t capacity;
+        bool closing;
+        bool failed;
+        std::mutex lock;
+        std::condition_variable ready;
+        std::condition_variable space;
+        std::string archivename;
+        int archivefd;
+        size_t archiveoffset;
+        std::vector<ArchiveEntry> entries;
+        std::thread thread;
+#ifdef HAVE_LIBURING
+        struct io_uring ring;
+        bool ringready;
+#endif
+        
+        void run();
+        void writeBatch(std::vector<Pending> & batch);
+        void writeArchive(std::vector<Pending> & batch);
+        bool writeAll(int fd, const uint8_t * data, size_t length, size_t offset, size_t base=0);
+        void error(const std::string & name);
+};
+
+#endif